@@ -0,0 +1,440 @@
+/*
+ * sipcmd, bench.cpp
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+// Microbenchmarks of the media hot paths on synthetic audio, no network
+// peer needed. Run with "make bench"; results are written as JSON, one
+// benchmark per line, and compared against a baseline when given one.
+
+#include <new>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <time.h>
+#include "main.h"
+#include "state.h"
+#include "commands.h"
+#include "rtpsender.h"
+#include "g711.h"
+
+// 20 ms of PCM16 at 8 kHz
+#define BENCH_FRAME_BYTES			320U
+#define BENCH_DEFAULT_FRAMES			50000U
+
+////
+// allocation counting
+static std::atomic< unsigned long> allocations(0UL);
+
+void *operator new(size_t size)
+{
+  allocations++;
+  void *p = malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size)
+{
+  allocations++;
+  void *p = malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) throw() { free(p); }
+void operator delete[](void *p) throw() { free(p); }
+void operator delete(void *p, size_t) throw() { free(p); }
+void operator delete[](void *p, size_t) throw() { free(p); }
+
+static int64_t NowNanos()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+////
+// results
+struct Result {
+  std::string name;
+  unsigned long frames;
+  double nsperframe;
+  double allocsperframe;
+  double mbpersec;
+};
+
+class Measure {
+  public:
+    Measure() : start(NowNanos()), paused(0), allocs(allocations) { }
+
+    // waits between Pause and Resume are not counted
+    void Pause() { paused -= NowNanos(); }
+    void Resume() { paused += NowNanos(); }
+
+    Result Done(const char *name, unsigned long frames, size_t bytes) {
+      int64_t ns = NowNanos() - start - paused;
+      Result r;
+      r.name = name;
+      r.frames = frames;
+      r.nsperframe = frames ? (double)ns / frames : 0.0;
+      r.allocsperframe = frames ?
+        (double)(allocations - allocs) / frames : 0.0;
+      r.mbpersec = ns ? bytes * 1000.0 / ns : 0.0;
+      return r;
+    }
+
+  private:
+    int64_t start;
+    int64_t paused;
+    unsigned long allocs;
+};
+
+static std::string ToJSON(const Result &r)
+{
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+      "{\"name\":\"%s\",\"frames\":%lu,\"ns_per_frame\":%.1f,"
+      "\"allocs_per_frame\":%.3f,\"mb_per_s\":%.1f}",
+      r.name.c_str(), r.frames, r.nsperframe, r.allocsperframe,
+      r.mbpersec);
+  return buf;
+}
+
+// ns_per_frame of each benchmark in a file written by ToJSON
+static std::map< std::string, double> ReadBaseline(const char *filename)
+{
+  std::map< std::string, double> baseline;
+  std::ifstream in(filename);
+  std::string line;
+  while (std::getline(in, line)) {
+    size_t n = line.find("\"name\":\"");
+    size_t ns = line.find("\"ns_per_frame\":");
+    if (n == std::string::npos  ||  ns == std::string::npos)
+      continue;
+    n += 8;
+    std::string name = line.substr(n, line.find('"', n) - n);
+    baseline[name] = atof(line.c_str() + ns + 15);
+  }
+  return baseline;
+}
+
+////
+// synthetic audio: a speech-like chirp under noise with DTMF bursts
+static void MakeAudio(std::vector< BYTE> &pcm, unsigned frames)
+{
+  pcm.resize((size_t)frames * BENCH_FRAME_BYTES);
+  short *x = reinterpret_cast< short *>(&pcm[0]);
+  size_t n = pcm.size() / 2;
+  unsigned seed = 1U;
+  for (size_t i = 0; i < n; i++) {
+    double t = (i % 8000) / 8000.0;
+    double v = 6000.0 * sin(2.0 * M_PI * (200.0 + 600.0 * t) * t)
+      * (0.5 + 0.5 * sin(2.0 * M_PI * 3.0 * t));
+    if ((i / 4000) % 4 == 1)
+      v = 7000.0 * sin(2.0 * M_PI * 770.0 * i / 8000.0)
+        + 8800.0 * sin(2.0 * M_PI * 1336.0 * i / 8000.0);
+    seed = seed * 1103515245U + 12345U;
+    v += (int)((seed >> 16) % 400U) - 200;
+    x[i] = (short)v;
+  }
+}
+
+////
+// helper threads for the commands that block until their media is done
+class PlayThread : public PThread
+{
+    PCLASSINFO(PlayThread, PThread);
+
+  public:
+    PlayThread(TestChanAudio &a, PBYTEArray &b)
+      : PThread(10000, NoAutoDeleteThread, NormalPriority, "BenchPlay"),
+      audio(a), buffer(b) {
+        Resume();
+      }
+
+    void Main() { audio.PlaybackAudioBuffer(buffer); }
+
+  private:
+    TestChanAudio &audio;
+    PBYTEArray &buffer;
+};
+
+class RecordThread : public PThread
+{
+    PCLASSINFO(RecordThread, PThread);
+
+  public:
+    RecordThread(TestChanAudio &a, int millis)
+      : PThread(10000, NoAutoDeleteThread, NormalPriority, "BenchRecord"),
+      audio(a), millis(millis) {
+        Resume();
+      }
+
+    void Main() {
+      audio.RecordAudioFile(PString("/dev/null"), false, false, millis);
+    }
+
+  private:
+    TestChanAudio &audio;
+    int millis;
+};
+
+////
+// benchmarks
+static Result BenchPlayback(const std::vector< BYTE> &pcm, unsigned frames)
+{
+  CallContext ctx;
+  ctx.SetState(TPState::ESTABLISHED);
+  TestChanAudio &audio = ctx.GetPlayBackAudio();
+  PBYTEArray buffer(&pcm[0], pcm.size());
+  PlayThread *player = new PlayThread(audio, buffer);
+  while (!audio.IsPlaying())
+    PThread::Sleep(1);
+
+  // the feeder tops the ring up every PLAYBACK_FEED_INTERVAL_MS like in
+  // a call; only frames it has queued are timed, so every one takes the
+  // dequeue path and none the underrun path
+  char out[BENCH_FRAME_BYTES];
+  const unsigned batch = PLAYBACK_RING_BYTES / BENCH_FRAME_BYTES - 1U;
+  unsigned long missed = audio.GetUnderruns();
+  Measure m;
+  for (unsigned i = 0; i < frames; ) {
+    unsigned n = frames - i < batch ? frames - i : batch;
+    m.Pause();
+    while (audio.GetPlaybackQueued() < (size_t)n * BENCH_FRAME_BYTES)
+      PThread::Sleep(1);
+    m.Resume();
+    for (unsigned k = 0; k < n; k++, i++)
+      audio.FillPlaybackBuffer(out, sizeof(out));
+  }
+  Result r = m.Done("playback", frames, (size_t)frames * sizeof(out));
+  if (audio.GetUnderruns() != missed)
+    std::cerr << "playback: " << audio.GetUnderruns() - missed
+      << " underruns while measuring" << std::endl;
+
+  audio.StopPlayback(false);
+  player->WaitForTermination();
+  delete player;
+  return r;
+}
+
+static Result BenchRecord(const std::vector< BYTE> &pcm, unsigned frames)
+{
+  CallContext ctx;
+  ctx.SetState(TPState::ESTABLISHED);
+  TestChanAudio &audio = ctx.GetRecordAudio();
+  RecordThread *recorder = new RecordThread(audio, frames * 20 + 1000);
+  while (!audio.IsRecording())
+    PThread::Sleep(1);
+
+  const char *data = reinterpret_cast< const char *>(&pcm[0]);
+  Measure m;
+  for (unsigned i = 0; i < frames; i++)
+    audio.RecordFromBuffer(data + (size_t)i * BENCH_FRAME_BYTES,
+        BENCH_FRAME_BYTES, false);
+  Result r = m.Done("record", frames, (size_t)frames * BENCH_FRAME_BYTES);
+
+  audio.StopRecording(false);
+  recorder->WaitForTermination();
+  delete recorder;
+  return r;
+}
+
+static Result BenchVAD(const std::vector< BYTE> &pcm, unsigned frames)
+{
+  CallContext ctx;
+  TestChanAudio &audio = ctx.GetRecordAudio();
+  const char *data = reinterpret_cast< const char *>(&pcm[0]);
+  Measure m;
+  for (unsigned i = 0; i < frames; i++)
+    audio.DetectSilence(data + (size_t)i * BENCH_FRAME_BYTES,
+        BENCH_FRAME_BYTES);
+  return m.Done("vad", frames, (size_t)frames * BENCH_FRAME_BYTES);
+}
+
+static Result BenchDTMF(const std::vector< BYTE> &pcm, unsigned frames)
+{
+  DtmfDetector detector;
+  std::vector< DtmfDetector::Tone> tones;
+  tones.reserve(1024);
+  const short *x = reinterpret_cast< const short *>(&pcm[0]);
+  Measure m;
+  for (unsigned i = 0; i < frames; i++) {
+    detector.Process(x + (size_t)i * BENCH_FRAME_BYTES / 2,
+        BENCH_FRAME_BYTES / 2, tones);
+    tones.clear();
+  }
+  return m.Done("dtmf", frames, (size_t)frames * BENCH_FRAME_BYTES);
+}
+
+static Result BenchG711(const std::vector< BYTE> &pcm, unsigned frames)
+{
+  // one frame is encoded and decoded, as sent and received with -m PCMU
+  const short *x = reinterpret_cast< const short *>(&pcm[0]);
+  BYTE codes[BENCH_FRAME_BYTES / 2];
+  short out[BENCH_FRAME_BYTES / 2];
+  Measure m;
+  for (unsigned i = 0; i < frames; i++) {
+    G711::Encode(G711::ULAW, x + (size_t)i * BENCH_FRAME_BYTES / 2,
+        BENCH_FRAME_BYTES / 2, codes);
+    G711::Decode(G711::ULAW, codes, BENCH_FRAME_BYTES / 2, out);
+  }
+  return m.Done("g711", frames, (size_t)frames * BENCH_FRAME_BYTES);
+}
+
+static Result BenchCompile(unsigned commands)
+{
+  // a generated script of the shape our test suites use
+  std::stringstream script;
+  for (unsigned i = 0; i < commands / 8; i++)
+    script << "lcall" << i << ";c" << 1000 + i << ";ws3000;d123#"
+      << ";vprompt" << i % 16 << ".wav;rsi4000rec" << i << ".raw"
+      << ";w200;j3lcall" << i << ";h;";
+  std::string text = script.str();
+
+  Measure m;
+  unsigned long compiled = 0UL;
+  for (unsigned rep = 0; rep < 10; rep++) {
+    Program program;
+    if (!program.Compile(text.c_str())) {
+      std::cerr << "compile failed: " << Command::GetErrorString()
+        << std::endl;
+      break;
+    }
+    compiled += program.GetSize();
+  }
+  // a "frame" is one compiled instruction here
+  return m.Done("compile", compiled, text.size() * 10);
+}
+
+static Result BenchRTPSend(const std::vector< BYTE> &pcm, unsigned frames)
+{
+  CallContext ctx;
+  RTP_Session::Params p;
+  p.id = OpalMediaType::Audio().GetDefinition()->GetDefaultSessionId();
+  p.encoding = OpalMediaType::Audio().GetDefinition()->GetRTPEncoding();
+  p.userData = NULL;
+  RTPSession *session = new RTPSession(p, ctx);
+  session->SelectAudioFormat(RTPSession::PCM16);
+  ctx.SetRTPSession(session);
+
+  // frames go to a port of our own that nobody reads
+  PIPSocket::Address local("127.0.0.1");
+  if (!session->Open(local, 0, 0, 2)
+      ||  !session->SetRemoteSocketInfo(local,
+        session->GetLocalDataPort(), true)) {
+    std::cerr << "rtp-send: cannot open a loopback session" << std::endl;
+    return Result();
+  }
+
+  RTPSender sender(ctx);
+  sender.SetPaced(false);
+  volatile bool stop = false;
+  size_t bytes = (size_t)frames * BENCH_FRAME_BYTES;
+  if (bytes > pcm.size())
+    bytes = pcm.size();
+
+  Measure m;
+  sender.Send(&pcm[0], bytes, stop);
+  return m.Done("rtp-send", sender.GetFramesSent(), bytes);
+}
+
+////
+// BenchProcess
+class BenchProcess : public PProcess
+{
+    PCLASSINFO(BenchProcess, PProcess);
+
+  public:
+    BenchProcess() : PProcess("sipcmd", "sipcmd-bench") { }
+    void Main();
+};
+
+PCREATE_PROCESS(BenchProcess);
+
+void BenchProcess::Main()
+{
+  PArgList &args = GetArguments();
+  args.Parse("o-output:b-baseline:n-frames:");
+  unsigned frames = args.HasOption('n') ?
+    args.GetOptionString('n').AsUnsigned() : BENCH_DEFAULT_FRAMES;
+  if (!frames)
+    frames = BENCH_DEFAULT_FRAMES;
+
+  Manager *manager = new Manager();
+  TPState::Instance().SetManager(manager);
+  TPState::Instance().SetProtocol(TPState::SIP);
+
+  std::vector< BYTE> pcm;
+  MakeAudio(pcm, frames);
+
+  std::vector< Result> results;
+  results.push_back(BenchPlayback(pcm, frames));
+  results.push_back(BenchRecord(pcm, frames));
+  results.push_back(BenchVAD(pcm, frames));
+  results.push_back(BenchDTMF(pcm, frames));
+  results.push_back(BenchG711(pcm, frames));
+  results.push_back(BenchCompile(frames / 10));
+  results.push_back(BenchRTPSend(pcm, frames));
+
+  std::stringstream json;
+  json << "{\"benchmarks\":[" << std::endl;
+  for (size_t i = 0; i < results.size(); i++)
+    json << "  " << ToJSON(results[i])
+      << (i + 1 < results.size() ? "," : "") << std::endl;
+  json << "]}" << std::endl;
+
+  if (args.HasOption('o')) {
+    std::ofstream out((const char *)args.GetOptionString('o'));
+    out << json.str();
+  }
+  std::cout << json.str();
+
+  // ns/frame change against the baseline, positive is slower
+  if (args.HasOption('b')) {
+    std::map< std::string, double> baseline =
+      ReadBaseline(args.GetOptionString('b'));
+    for (size_t i = 0; i < results.size(); i++) {
+      std::map< std::string, double>::iterator it =
+        baseline.find(results[i].name);
+      if (it == baseline.end()  ||  it->second <= 0.0)
+        continue;
+      char buf[128];
+      snprintf(buf, sizeof(buf), "%-10s %10.1f -> %10.1f ns/frame %+6.1f%%",
+          results[i].name.c_str(), it->second, results[i].nsperframe,
+          100.0 * (results[i].nsperframe - it->second) / it->second);
+      std::cout << buf << std::endl;
+    }
+  }
+
+  TPState::Instance().SetManager(NULL);
+  delete manager;
+}
+
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
@@ -0,0 +1,301 @@
+/*
+ * sipcmd, audiocache.cpp
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <ptclib/pwavfile.h>
+#include "audiocache.h"
+#include "resample.h"
+
+AudioCache *AudioCache::instance = NULL;
+
+static inline unsigned GetLE16(const BYTE *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static inline unsigned GetLE32(const BYTE *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+// walks the RIFF chunks of a WAV file
+// -returns true, the format and the data chunk if the samples are PCM,
+//  float or G.711 the converter takes
+static bool FindWavData(const BYTE *p, size_t len, PcmFormat &fmt,
+    size_t &offset, size_t &datalen) {
+
+  if (len < 12  ||  memcmp(p, "RIFF", 4)  ||  memcmp(p + 8, "WAVE", 4))
+    return false;
+
+  bool supported = false;
+  size_t pos = 12;
+  while (pos + 8 <= len) {
+    size_t chunklen = GetLE32(p + pos + 4);
+    const BYTE *chunk = p + pos + 8;
+    if (!memcmp(p + pos, "fmt ", 4)  &&  chunklen >= 16
+        &&  pos + 8 + 16 <= len) {
+      unsigned tag = GetLE16(chunk);
+      // WAVE_FORMAT_EXTENSIBLE carries the tag in its sub format GUID
+      if (tag == 0xFFFE  &&  chunklen >= 40  &&  pos + 8 + 40 <= len)
+        tag = GetLE16(chunk + 24);
+      fmt.encoding = tag == 3 ? PcmFormat::FLOAT :
+        tag == 6 ? PcmFormat::ALAW :
+        tag == 7 ? PcmFormat::ULAW : PcmFormat::INTEGER;
+      fmt.channels = GetLE16(chunk + 2);
+      fmt.rate = GetLE32(chunk + 4);
+      fmt.bits = GetLE16(chunk + 14);
+      supported = (tag == 1  ||  tag == 3  ||  tag == 6  ||  tag == 7)
+        &&  fmt.IsSupported();
+    }
+    else if (!memcmp(p + pos, "data", 4)) {
+      if (!supported)
+        return false;
+      offset = pos + 8;
+      // the header of a file still being written may claim more
+      datalen = chunklen < len - offset ? chunklen : len - offset;
+      return true;
+    }
+    // chunks are padded to even length
+    pos += 8 + chunklen + (chunklen & 1);
+  }
+  return false;
+}
+
+MappedAudioAsset::MappedAudioAsset(void *addr, size_t len,
+    size_t offset, size_t datalen)
+  : AudioAsset(), base(addr), maplen(len)
+{
+  data = static_cast< const BYTE *>(base) + offset;
+  size = datalen & ~(size_t)1;
+}
+
+MappedAudioAsset::~MappedAudioAsset()
+{
+  if (base)
+    munmap(base, maplen);
+}
+
+MappedAudioAsset *MappedAudioAsset::Map(const std::string &path, bool wav,
+    unsigned rate)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0  ||  st.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+
+  size_t len = st.st_size;
+  void *addr = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED)
+    return NULL;
+
+  size_t offset = 0U;
+  size_t datalen = len;
+  PcmFormat fmt;
+  if (wav  &&  (!FindWavData(static_cast< const BYTE *>(addr), len,
+          fmt, offset, datalen)  ||  !fmt.IsSession(rate))) {
+    munmap(addr, len);
+    return NULL;
+  }
+
+  // prompts are read front to back once per playback
+  madvise(addr, len, MADV_SEQUENTIAL);
+  madvise(addr, len, MADV_WILLNEED);
+  return new MappedAudioAsset(addr, len, offset, datalen);
+}
+
+// decodes a WAV file of any supported format, down-mixes and resamples
+// it to mono PCM16 at 'rate'
+// -returns NULL if the file is not such a WAV file
+static AudioAsset *ConvertWav(const PString &filename, unsigned rate)
+{
+  PFile file(filename, PFile::ReadOnly, PFile::MustExist);
+  if (!file.IsOpen())
+    return NULL;
+  std::vector< BYTE> raw((size_t)file.GetLength());
+  if (raw.empty()  ||  !file.Read(&raw[0], raw.size()))
+    return NULL;
+  raw.resize(file.GetLastReadCount());
+
+  PcmFormat fmt;
+  size_t offset, datalen;
+  if (!FindWavData(&raw[0], raw.size(), fmt, offset, datalen))
+    return NULL;
+
+  std::vector< float> mono;
+  DownmixToMono(&raw[offset], datalen, fmt, mono);
+  std::vector< BYTE>().swap(raw);
+
+  std::vector< short> pcm;
+  if (fmt.rate == rate)
+    ToPCM16(mono, pcm);
+  else
+    Resampler(fmt.rate, rate).Process(mono, pcm);
+
+  std::cerr << "AudioCache::" << __func__ << ": converted \"" << filename
+    << "\" from " << fmt.channels << " channel "
+    << (fmt.encoding == PcmFormat::FLOAT ? "float" :
+        fmt.encoding == PcmFormat::ULAW ? "mu-law" :
+        fmt.encoding == PcmFormat::ALAW ? "A-law" : "PCM") << fmt.bits
+    << " at " << fmt.rate << " Hz to " << rate << " Hz ("
+    << pcm.size() << " samples)" << endl;
+  const BYTE *bytes = reinterpret_cast< const BYTE *>(pcm.data());
+  return new BufferAudioAsset(bytes, pcm.size() * sizeof(short));
+}
+
+AudioAssetPtr AudioCache::Load(const PString &filename, unsigned rate)
+{
+  PINDEX extind = filename.GetLength() - 4;
+  bool wav = extind >= 1  &&  filename.Mid(extind).ToLower() == ".wav";
+
+  // session format files are played straight from the mapping
+  MappedAudioAsset *mapped = MappedAudioAsset::Map(filename, wav, rate);
+  if (mapped) {
+    std::cerr << "AudioCache::" << __func__ << ": mapped file \""
+      << filename << "\" (" << mapped->GetSize() << " bytes)" << endl;
+    return AudioAssetPtr(mapped);
+  }
+
+  // other PCM, float and G.711 WAV files are converted once, the cache keeps
+  // the result
+  if (wav) {
+    AudioAsset *converted = ConvertWav(filename, rate);
+    if (converted)
+      return AudioAssetPtr(converted);
+  }
+
+  PFile *file;
+  // check if WAV file
+  if (wav) {
+    std::cerr << "AudioCache::" << __func__ << ": opening file \""
+      << filename << "\" as WAV" << endl;
+    file = new PWAVFile(filename, PFile::ReadOnly, PFile::MustExist);
+  }
+  // raw data it is then
+  else {
+    std::cerr << "AudioCache::" << __func__ << ": opening file \""
+      << filename << "\" as raw" << endl;
+    file = new PFile(filename, PFile::ReadOnly, PFile::MustExist);
+  }
+
+  AudioAssetPtr asset;
+  if (file->IsOpen()) {
+    // PWAVFile reports the length of the data chunk only
+    PBYTEArray pcm((PINDEX)file->GetLength());
+    if (file->Read(pcm.GetPointer(), pcm.GetSize()))
+      asset.reset(new BufferAudioAsset(pcm, file->GetLastReadCount()));
+  }
+
+  if (!asset)
+    std::cerr << "AudioCache::" << __func__ << ": error reading \""
+      << filename << "\"" << endl;
+
+  file->Close();
+  delete file;
+  return asset;
+}
+
+AudioAssetPtr AudioCache::Get(const PString &filename, unsigned rate)
+{
+  std::string path = filename;
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    std::cerr << "AudioCache::" << __func__ << ": no such file \""
+      << path << "\"" << endl;
+    return AudioAssetPtr();
+  }
+  std::ostringstream key;
+  key << path << '@' << rate;
+
+  {
+    PWaitAndSignal lock(mutex);
+    std::map< std::string, EntryList::iterator>::iterator it =
+      index.find(key.str());
+    if (it != index.end()) {
+      if (it->second->mtime == st.st_mtime) {
+        hits++;
+        lru.splice(lru.begin(), lru, it->second);
+        return it->second->asset;
+      }
+
+      // file changed on disk, drop the stale copy
+      bytes -= it->second->asset->GetSize();
+      lru.erase(it->second);
+      index.erase(it);
+    }
+    misses++;
+  }
+
+  // decode outside the lock, other calls keep hitting meanwhile
+  AudioAssetPtr asset = Load(filename, rate);
+  if (!asset  ||  asset->GetSize() > maxbytes)
+    return asset;
+
+  PWaitAndSignal lock(mutex);
+  if (index.find(key.str()) == index.end()) {
+    Entry e;
+    e.key = key.str();
+    e.mtime = st.st_mtime;
+    e.asset = asset;
+    lru.push_front(e);
+    index[key.str()] = lru.begin();
+    bytes += asset->GetSize();
+    Evict();
+  }
+  return asset;
+}
+
+void AudioCache::Evict()
+{
+  // assets still playing stay alive until their last user lets go
+  while (bytes > maxbytes  &&  !lru.empty()) {
+    Entry &e = lru.back();
+    bytes -= e.asset->GetSize();
+    index.erase(e.key);
+    lru.pop_back();
+    evictions++;
+  }
+}
+
+void AudioCache::SetMaxBytes(size_t max)
+{
+  PWaitAndSignal lock(mutex);
+  maxbytes = max;
+  Evict();
+}
+
+void AudioCache::PrintStats(ostream &os)
+{
+  PWaitAndSignal lock(mutex);
+  os << "prompt cache: hits " << hits
+    << " misses " << misses
+    << " evictions " << evictions
+    << " entries " << lru.size()
+    << " bytes " << bytes << "/" << maxbytes << std::endl;
+}
+
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
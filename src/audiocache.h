@@ -0,0 +1,143 @@
+/*
+ * sipcmd, audiocache.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#ifndef AUDIOCACHE_H
+#define AUDIOCACHE_H
+
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "includes.h"
+
+// prompts are converted to the stream's rate, this one by default
+#define AUDIO_SESSION_RATE			8000U
+// default memory cap of the prompt cache
+#define AUDIO_CACHE_DEFAULT_KBYTES		16384U
+
+// A decoded prompt (PCM16 in session format). Immutable once built, so it
+// can be shared between loop iterations and concurrent calls.
+class AudioAsset {
+  public:
+    virtual ~AudioAsset() { }
+
+    const BYTE *GetPointer() const { return data; }
+    size_t GetSize() const { return size; }
+
+  protected:
+    AudioAsset() : data(NULL), size(0U) { }
+
+    const BYTE *data;
+    size_t size;
+
+  private:
+    AudioAsset(const AudioAsset&);
+    AudioAsset operator=(AudioAsset&);
+};
+
+// prompt decoded into memory
+class BufferAudioAsset : public AudioAsset {
+  public:
+    BufferAudioAsset(const BYTE *pcm, size_t len) : buffer(pcm, pcm + len) {
+      data = buffer.empty() ? NULL : &buffer[0];
+      size = buffer.size();
+    }
+
+  private:
+    const std::vector< BYTE> buffer;
+};
+
+// prompt already in session format, played straight from a read only
+// mapping of the file. Replace such files by renaming over them, a file
+// truncated in place while it plays faults the reader.
+class MappedAudioAsset : public AudioAsset {
+  public:
+    ~MappedAudioAsset();
+
+    // maps a raw file or the data chunk of a WAV file
+    // -returns NULL if the file cannot be played at 'rate' without
+    //  conversion
+    static MappedAudioAsset *Map(const std::string &path, bool wav,
+        unsigned rate);
+
+  private:
+    MappedAudioAsset(void *addr, size_t len, size_t offset, size_t datalen);
+
+    void *base;
+    size_t maplen;
+};
+
+typedef std::shared_ptr< const AudioAsset> AudioAssetPtr;
+
+// Process wide cache of decoded prompts keyed by path, rate and mtime,
+// with a memory cap and least recently used eviction.
+class AudioCache {
+  public:
+    static AudioCache &Instance() {
+      if (!instance)
+        instance = new AudioCache();
+      return *instance;
+    }
+
+    // returns the prompt decoded to mono PCM16 at 'rate', loading it on a
+    // miss; raw files are taken to be at that rate already
+    // -returns an empty pointer if the file cannot be read
+    AudioAssetPtr Get(const PString &filename,
+        unsigned rate = AUDIO_SESSION_RATE);
+
+    void SetMaxBytes(size_t max);
+    void PrintStats(ostream &os);
+
+    // decodes a prompt without caching it, for converters of their own
+    static AudioAssetPtr Load(const PString &filename, unsigned rate);
+
+  private:
+    static AudioCache *instance;
+
+    struct Entry {
+      std::string key;          // path and rate
+      time_t mtime;
+      AudioAssetPtr asset;
+    };
+    typedef std::list< Entry> EntryList;
+
+    void Evict();
+
+    PMutex mutex;
+    EntryList lru;
+    std::map< std::string, EntryList::iterator> index;
+    size_t bytes;
+    size_t maxbytes;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+
+    AudioCache()
+      : mutex(), lru(), index(), bytes(0U),
+      maxbytes(AUDIO_CACHE_DEFAULT_KBYTES * 1024U),
+      hits(0UL), misses(0UL), evictions(0UL)
+  { }
+};
+
+#endif // AUDIOCACHE_H
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
@@ -0,0 +1,102 @@
+/*
+ * sipcmd, audioprops.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#ifndef AUDIOPROPS_H
+#define AUDIOPROPS_H
+
+#include <stddef.h>
+#include "includes.h"
+
+// narrowband defaults, what -P rtp and G.711 calls carry
+#define AUDIO_DEFAULT_RATE			8000U
+#define AUDIO_DEFAULT_FRAME_MILLIS		20U
+
+// Sample rate, sample size and frame duration of the PCM on one media
+// stream, taken from the negotiated format. Every byte/time conversion of
+// the media path goes through here, so wideband streams record and pace
+// right. Rates with a whole number of bytes per ms take the integer path.
+// A stream may carry G.711 instead, one code byte per sample; the
+// conversions still describe the PCM16 it decodes to.
+class AudioProperties {
+  public:
+    enum Encoding {
+      PCM16,
+      G711_ULAW,
+      G711_ALAW
+    };
+
+    AudioProperties(unsigned samplerate = AUDIO_DEFAULT_RATE,
+        unsigned framemillis = AUDIO_DEFAULT_FRAME_MILLIS,
+        unsigned samplesize = 2U)
+      : rate(samplerate), samplebytes(samplesize), framems(framemillis),
+      bytespersec(samplerate * samplesize),
+      bytesperms(bytespersec % 1000U ? 0U : bytespersec / 1000U),
+      encoding(PCM16) { }
+
+    // raw PCM16 of a local media stream, or G.711 passed through
+    static AudioProperties FromMediaFormat(const OpalMediaFormat &mf) {
+      unsigned clock = mf.GetClockRate() ? mf.GetClockRate() :
+        AUDIO_DEFAULT_RATE;
+      // raw formats have short nominal frames, packets are longer
+      unsigned ms = mf.GetFrameTime() * 1000U / clock;
+      AudioProperties props(clock, ms > AUDIO_DEFAULT_FRAME_MILLIS ?
+          ms : AUDIO_DEFAULT_FRAME_MILLIS);
+      if (mf.GetPayloadType() == RTP_DataFrame::PCMU)
+        props.SetEncoding(G711_ULAW);
+      else if (mf.GetPayloadType() == RTP_DataFrame::PCMA)
+        props.SetEncoding(G711_ALAW);
+      return props;
+    }
+
+    Encoding GetEncoding() const { return encoding; }
+    void SetEncoding(Encoding e) { encoding = e; }
+    bool IsEncoded() const { return encoding != PCM16; }
+    // bytes of PCM16 a frame of 'wire' bytes decodes to
+    size_t WireToPcmBytes(size_t wire) const {
+      return encoding == PCM16 ? wire : wire * samplebytes;
+    }
+
+    unsigned GetSampleRate() const { return rate; }
+    unsigned GetSampleBytes() const { return samplebytes; }
+    unsigned GetFrameMillis() const { return framems; }
+    size_t GetFrameBytes() const { return MillisToBytes(framems); }
+
+    size_t MillisToBytes(unsigned millis) const {
+      return bytesperms ? (size_t)millis * bytesperms :
+        (size_t)millis * rate / 1000U * samplebytes;
+    }
+    unsigned BytesToMillis(size_t bytes) const {
+      return (unsigned)(bytesperms ? bytes / bytesperms :
+          bytes * 1000U / bytespersec);
+    }
+    size_t BytesToSamples(size_t bytes) const { return bytes / samplebytes; }
+
+  private:
+    unsigned rate;
+    unsigned samplebytes;
+    unsigned framems;
+    unsigned bytespersec;
+    unsigned bytesperms;
+    Encoding encoding;
+};
+
+#endif // AUDIOPROPS_H
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
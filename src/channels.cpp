@@ -27,6 +27,13 @@
 #include "channels.h"
 #include "main.h"
 #include "state.h"
+#include "g711.h"
+
+bool TestChanAudio::recordencoded = false;
+
+static inline G711::Law LawOf(AudioProperties::Encoding e) {
+  return e == AudioProperties::G711_ALAW ? G711::ALAW : G711::ULAW;
+}
 
 bool TestChanAudio::PlaybackAudio(const bool raw_rtp) {
 
@@ -36,10 +43,35 @@ bool TestChanAudio::PlaybackAudio(const bool raw_rtp) {
     playback = true;
     
     if (!raw_rtp) {
+      // we feed the ring ahead of the media thread, which never waits on
+      // us, and are done once it has read past our last byte. The lock
+      // is not held while feeding, StopPlayback ends the loop.
+      AudioAssetPtr asset = playasset;
+      const BYTE *data = asset->GetPointer();
+      size_t size = asset->GetSize();
+      unsigned long missed = underruns;
+      stopplayback = false;
+      size_t fed = playring.Write(data, size);
+      playend = playring.GetWritePosition() + (size - fed);
       sync.Signal();
-      playsync.Wait();
+
+      for (;;) {
+        fed += playring.Write(data + fed, size - fed);
+        size_t left = playend - playring.GetReadPosition();
+        if (stopplayback  ||  (ptrdiff_t)left <= 0
+            ||  context.GetState() != TPState::ESTABLISHED)
+          break;
+        // wake up in time for the end of the prompt
+        size_t millis = fed < size ? PLAYBACK_FEED_INTERVAL_MS :
+          format.BytesToMillis(left);
+        PThread::Sleep(millis < 1 ? 1 : (millis > PLAYBACK_FEED_INTERVAL_MS ?
+              PLAYBACK_FEED_INTERVAL_MS : millis));
+      }
+
+      AutoSync a(sync);
       std::cerr << "TestChanAudio::PlaybackAudio: play back done "
-        << playback << endl;
+        << playback << ", " << underruns - missed << " underruns" << endl;
+      playasset.reset();
 
       // check if playback ok
       bool playbackfailed = !playback;
@@ -47,71 +79,151 @@ bool TestChanAudio::PlaybackAudio(const bool raw_rtp) {
       return !playbackfailed;
     }
     
-    Manager *m = TPState::Instance().GetManager();
-    // write directly to rtp stream.
-    //size_t recordbytes = recordmillisec * BYTES_PER_MILLIS;
-    
-    PAdaptiveDelay delay;
-    int i = 0;
-   
-    unsigned timestamp = PRandom::Number();
-
-    while(true) {
-      RTP_DataFrame *frame = new RTP_DataFrame();
-      frame->SetPayloadSize(640);
-      timestamp += m->CalculateTimestamp(640);
-      frame->SetTimestamp(timestamp);
-      //frame->SetTimestamp(m->CalculateTimestamp(1));
-      if (!playfile->Read(frame->GetPayloadPtr(), frame->GetPayloadSize())) {
-        delete frame;
-        break;
-      }
-      if (!m->WriteFrame(*frame)) {
-        std::cerr << "RTP write failed" << std::endl;
-        break;
-      }
-      i++;
-      delete frame;
-      //delay.Delay(20);
-    }
+    // write directly to rtp stream, paced at the media rate. The lock is
+    // not held while sending, StopPlayback ends the loop.
+    if (!rtpsender)
+      rtpsender = new RTPSender(context);
+
+    AudioAssetPtr asset = playasset;
+    unsigned long frames = rtpsender->GetFramesSent();
+    unsigned long late = rtpsender->GetLateSends();
+    stopplayback = false;
+    sync.Signal();
+
+    bool ok = rtpsender->Send(
+        asset->GetPointer(), asset->GetSize(), stopplayback);
+
+    AutoSync a(sync);
     std::cerr << "TestChanAudio::PlaybackAudio: play back done "
          << playback << endl
-         << "wrote " << i * 640 << " bytes " << endl;
+         << "sent " << rtpsender->GetFramesSent() - frames << " frames, "
+         << rtpsender->GetLateSends() - late << " late" << endl;
+    playasset.reset();
     playback = false;
-    return true;
+    return ok;
 }
 
 
+bool TestChanAudio::PlaybackAudioStream(const PString &source,
+        bool raw_rtp) {
+
+    PlaybackStream *stream = PlaybackStream::Open(source,
+            format.GetSampleRate());
+    if (!stream) {
+        sync.Signal();
+        return false;
+    }
+    std::cerr << __func__ << ": streaming from \"" << source << "\"" << endl;
+    playback = true;
+    playstreaming = true;
+    stopplayback = false;
+    unsigned long missed = underruns;
+    sync.Signal();
+
+    // the jitter pre-buffer: the first audio waits for this much or EOF
+    size_t prebuffer = format.MillisToBytes(
+            PlaybackStream::GetPrebufferMillis());
+    if (prebuffer > PLAYBACK_STREAM_MAX_PENDING)
+        prebuffer = PLAYBACK_STREAM_MAX_PENDING;
+    while (!stopplayback  &&  stream->GetPending() < prebuffer
+            &&  context.GetState() == TPState::ESTABLISHED
+            &&  stream->Fill(PLAYBACK_FEED_INTERVAL_MS));
+
+    bool ok = true;
+    if (!raw_rtp) {
+      // open ended until EOF: the media thread plays silence and counts
+      // an underrun whenever the source falls behind
+      playend = playring.GetWritePosition() + ((size_t)-1 >> 1);
+      bool ended = false;
+      for (;;) {
+        stream->Consume(playring.Write(stream->GetData(),
+              stream->GetPending()));
+        if (!ended  &&  stream->IsEOF()  &&  !stream->GetPending()) {
+          playend = playring.GetWritePosition();
+          ended = true;
+        }
+        size_t left = playend - playring.GetReadPosition();
+        if (stopplayback  ||  (ptrdiff_t)left <= 0
+            ||  context.GetState() != TPState::ESTABLISHED)
+          break;
+        // after EOF, Fill returns at once; the ring drains what's left
+        if (!stream->IsEOF())
+          stream->Fill(PLAYBACK_FEED_INTERVAL_MS);
+        else {
+          size_t millis = format.BytesToMillis(left);
+          PThread::Sleep(millis < 1 ? 1 :
+              (millis > PLAYBACK_FEED_INTERVAL_MS ?
+               PLAYBACK_FEED_INTERVAL_MS : millis));
+        }
+      }
+    }
+    else {
+      // one paced frame at a time, silence when nothing has arrived
+      if (!rtpsender)
+        rtpsender = new RTPSender(context);
+      const size_t framebytes = format.MillisToBytes(RTP_FRAME_MILLIS);
+      std::vector< BYTE> silence(framebytes, 0);
+      rtpsender->Begin();
+      while (ok  &&  !stopplayback
+          &&  context.GetState() != TPState::TERMINATED) {
+        if (stream->GetPending() < framebytes)
+          stream->Fill(0);
+        size_t bytes = stream->GetPending() < framebytes ?
+          stream->GetPending() : framebytes;
+        if (bytes == framebytes  ||  (bytes  &&  stream->IsEOF())) {
+          ok = rtpsender->SendFrame(stream->GetData(), bytes);
+          stream->Consume(bytes);
+        }
+        else if (stream->IsEOF())
+          break;
+        else {
+          underruns++;
+          ok = rtpsender->SendFrame(&silence[0], framebytes);
+        }
+      }
+    }
+
+    AutoSync a(sync);
+    std::cerr << "TestChanAudio::" << __func__ << ": play back done "
+      << playback << ", " << underruns - missed << " underruns" << endl;
+    ok = ok  &&  playback  &&  !stream->Failed();
+    delete stream;
+    playstreaming = false;
+    playback = false;
+    return ok;
+}
+
 void TestChanAudio::StopAudioPlayback(bool ioerror) {
 
     std::cerr << __func__ << std::endl;
 
-    if(playfile) {
-        PFile *ftemp = playfile;
-        playfile = NULL;
-        ftemp->Close();
-        delete ftemp;
+    if(playasset  ||  playstreaming) {
+        playasset.reset();
+        stopplayback = true;
+        // the media thread skips what is still queued
+        playring.Discard();
 
-        if(playback) {
-            playback = !ioerror;
-            playsync.Signal();
-        }
+        if(playback  &&  ioerror)
+            playback = false;
     }
 }
 
 void TestChanAudio::StopAudioRecording(bool ioerror) {
     
     std::cerr << __func__ << std::endl;
-    if(recfile) {
-        PFile *ftemp = recfile;
-        recfile = NULL;
-        ftemp->Close();
-        delete ftemp;
+    if(recwriter) {
+        RecordWriter *wtemp = recwriter;
+        recwriter = NULL;
 
         if(record) {
+            // the waiting script drains the ring, the media thread
+            // must not wait for the disk
             record = !ioerror;
+            recdone = wtemp;
             recsync.Signal();
         }
+        else
+            delete wtemp;
     }
 }
 
@@ -119,55 +231,45 @@ bool TestChanAudio::PlaybackAudioBuffer(PBYTEArray &buffer) {
 
     //std::cerr << __func__ << std::endl;
     sync.Wait();
-    if(TPState::Instance().GetState() != TPState::ESTABLISHED) {
+    if(context.GetState() != TPState::ESTABLISHED) {
         std::cerr << __func__ << ": state "
-            << TPState::Instance().GetState() << endl;
+            << context.GetState() << endl;
         sync.Signal();
         return true;
     }
 
-    // open file
-    assert(!playfile);
-    playfile = new PMemoryFile(buffer);
+    // wrap buffer, not cached
+    assert(!playasset);
+    playasset.reset(new BufferAudioAsset(buffer, buffer.GetSize()));
     std::cerr << __func__ << ": starting playback of "
-        << playfile->GetLength() << " bytes" << endl;
-
-    if(!playfile->SetPosition(0, PFile::Start)) {
-        cerr << __func__ << ": unable to set "
-            << "initial position to 0" << endl;
-    }
+        << playasset->GetSize() << " bytes" << endl;
 
     // start playback
     return PlaybackAudio(TPState::Instance().GetProtocol() == TPState::RTP);
 }
 
-bool TestChanAudio::PlaybackAudioFile(PString &filename) {
+bool TestChanAudio::PlaybackAudioFile(const PString &filename) {
     std::cerr << __func__ << std::endl;
     sync.Wait();
-    if(TPState::Instance().GetState() != TPState::ESTABLISHED) {
+    if(context.GetState() != TPState::ESTABLISHED) {
         std::cerr << __func__ << ": state "
-            << TPState::Instance().GetState() << endl;
+            << context.GetState() << endl;
         sync.Signal();
         return true;
     }
 
-    //open file
-    assert(!playfile);
-    PINDEX extind = filename.GetLength() - 4;
-
-    // check if WAV file
-    if(extind >= 1  &&  filename.Mid(extind).ToLower() == ".wav") {
-        std::cerr << __func__ << ": opening file \""
-            << filename << "\" as WAV" << endl;
+    // live sources are not cached
+    if(PlaybackStream::IsStreamSource(filename))
+        return PlaybackAudioStream(filename,
+                TPState::Instance().GetProtocol() == TPState::RTP);
 
-        playfile = new PWAVFile(
-                filename, PFile::ReadOnly, PFile::MustExist);
-    }
-    // raw data it is then
-    else {
-        std::cerr << __func__ << ": opening file \""
-            << filename << "\" as raw" << endl;
-        playfile = new PFile(filename, PFile::ReadOnly, PFile::MustExist);
+    // decoded prompts are shared through the cache
+    assert(!playasset);
+    playasset = AudioCache::Instance().Get(filename,
+            format.GetSampleRate());
+    if(!playasset) {
+        sync.Signal();
+        return false;
     }
 
     // start playback
@@ -176,87 +278,71 @@ bool TestChanAudio::PlaybackAudioFile(PString &filename) {
 
 
 void TestChanAudio::FillPlaybackBuffer(char *buf, size_t len) {
-  //std::cerr << "TestChanAudio::FillPlaybackBuffer: begin " << len << endl;
-  AutoSync a(sync);
-  size_t readcount = 0U;
-
-  if (playfile) {
-    bool ok = playfile->Read( buf, len);
-
-    // memoryfile returns ioerror when file ends...
-    ok |= playfile->GetPosition() == playfile->GetLength();
+  if (!format.IsEncoded()) {
+    FillPlaybackPCM(buf, len);
+    return;
+  }
 
-    if(ok)
-      readcount = playfile->GetLastReadCount();
-    else
-      cerr << "TestChanAudio::FillPlaybackBuffer: I/O error" << endl;
+  // the rings hold PCM16, a G.711 stream takes a code byte per sample
+  if (decoded.size() < len)
+    decoded.resize(len);
+  FillPlaybackPCM(reinterpret_cast< char *>(&decoded[0]),
+      format.WireToPcmBytes(len));
+  G711::Encode(LawOf(format.GetEncoding()), &decoded[0], len,
+      reinterpret_cast< BYTE *>(buf));
+}
 
-    if (readcount < len) {
-      StopAudioPlayback( !ok);
-    }
-  }
+void TestChanAudio::FillPlaybackPCM(char *buf, size_t len) {
+  // media thread: only dequeues, the script side may be busy or stalled
+  context.GetTimeline().Mark(CallTimeline::RTP_OUT);
+  size_t readcount = playring.Read(buf, len);
+  if (readcount < len  &&  playback
+      &&  (ptrdiff_t)(playend - playring.GetReadPosition()) > 0)
+    underruns++;
+
+  // echo fills what no prompt does
+  if (readcount < len)
+    readcount += echoring.Read(&buf[readcount], len - readcount);
   if (readcount < len) {
     memset(&buf[readcount], 0, len - readcount);
   }
-
-  //std::cerr << "TestChanAudio::FillPlaybackBuffer: end " << readcount << endl;
-
-    /*
-    //std::cerr << __func__ << " begin: " << len << std::endl;
-    AutoSync a(sync);
-    size_t readcount = 0U;
-
-    if (playfile) {
-        //bool ok = playfile->RawRead(buf, len);
-        // memoryfile returns ioerror when file ends...
-        //ok |= playfile->GetPosition() == playfile->GetLength();
-
-        int i = 0;
-        bool ok = false;
-        for (; i < 5; i++) {
-            ok = playfile->Read(buf, len);
-            if (ok)
-                break;
-
-            sleep(1);
-        }
-
-        if (ok)
-            readcount = playfile->GetLastReadCount();
-        else
-            std::cerr << __func__ << " I/O error" << std::endl;
-
-        if (readcount < len)
-            StopAudioPlayback(!ok);
-    }
-    if (readcount < len)
-        memset(&buf[ readcount], 0, len - readcount);
-        */
 }
 
 
-bool TestChanAudio::RecordAudioFile(PString &filename,
-        bool append_file, bool stop_on_silence, int max_millisec) {
+void TestChanAudio::QueueEcho(const char *buf, size_t len) {
+  // what does not fit is dropped, the echo delay stays bounded
+  if (!playback)
+    echoring.Write(buf, len);
+}
 
-    //std::cerr << __func__ << std::endl;
-    sync.Wait();
-    /*
-    if(TPState::Instance().GetState() != TPState::ESTABLISHED) {
-        std::cerr << __func__ << ": state "
-            << TPState::Instance().GetState() << endl;
 
-        sync.Signal();
-        return true;
-    }
-*/
-    assert(!recfile);
+PFile *TestChanAudio::OpenRecordFile(const PString &filename,
+        bool append_file) {
+    PFile *recfile;
     PINDEX extind = filename.GetLength() - 4;
+    // G.711 as received, the header is ours
+    if(recencoding != AudioProperties::PCM16  &&  extind >= 1
+            &&  filename.Mid(extind).ToLower() == ".wav") {
+        std::cerr << __func__ << ": opening file \""
+            << filename << "\" as G.711 WAV" << endl;
+        G711WAVFile *wavfile = new G711WAVFile(LawOf(recencoding),
+                format.GetSampleRate());
+        if(!wavfile->OpenForRecording(filename, append_file)) {
+            delete wavfile;
+            return NULL;
+        }
+        recfile = wavfile;
+    }
     // check if WAV file
-    if(extind >= 1  &&  filename.Mid(extind).ToLower() == ".wav") {
+    else if(extind >= 1  &&  filename.Mid(extind).ToLower() == ".wav") {
         std::cerr << __func__ << ": opening file \""
             << filename << "\" as WAV" << endl;
-        recfile = new PWAVFile(filename, PFile::ReadWrite,
+        PWAVFile *wavfile = new PWAVFile(filename, PFile::ReadWrite,
                 append_file? PFile::Create: PFile::Create | PFile::Truncate);
+        // new files take the rate of the stream, not the 8 kHz default
+        if(!append_file  &&  wavfile->IsOpen())
+            wavfile->SetSampleRate(format.GetSampleRate());
+        recfile = wavfile;
     }
     // raw data it is then
     else {
@@ -274,13 +360,57 @@ bool TestChanAudio::RecordAudioFile(PString &filename,
             cerr << __func__ << ": setting file pointer"
                 << " to end of file failed" << std::endl;
 
-                sync.Signal();
+            recfile->Close();
+            delete recfile;
+            return NULL;
+        }
+    }
+    return recfile;
+}
+
+bool TestChanAudio::RecordAudioFile(const PString &filename,
+        bool append_file, bool stop_on_silence, int max_millisec) {
+
+    //std::cerr << __func__ << std::endl;
+    sync.Wait();
+    /*
+    if(context.GetState() != TPState::ESTABLISHED) {
+        std::cerr << __func__ << ": state "
+            << context.GetState() << endl;
+
+        sync.Signal();
+        return true;
+    }
+*/
+    assert(!recwriter);
+    recencoding = recordencoded ? format.GetEncoding() :
+        AudioProperties::PCM16;
+    recstreaming = RecordStream::IsStreamTarget(filename);
+    recsamples = 0U;
+    if(recstreaming) {
+        // live consumers get the frames as they arrive
+        std::cerr << __func__ << ": streaming to \""
+            << filename << "\"" << endl;
+        RecordStream *stream = RecordStream::Create(filename, format,
+                recencoding, context.GetId());
+        if(!stream) {
+            sync.Signal();
+            return false;
+        }
+        recwriter = new RecordWriter(stream, RECORD_STREAM_RING_BYTES,
+                RECORD_STREAM_FLUSH_INTERVAL_MS);
+    }
+    else {
+        PFile *recfile = OpenRecordFile(filename, append_file);
+        if(!recfile) {
+            sync.Signal();
             return false;
         }
+        recwriter = new RecordWriter(recfile);
     }
 
     // set other flags
-    TPState::Instance().SetSilenceState(false, 0U);
+    context.SetSilenceState(false, 0U);
     stop_recording_when_silent = stop_on_silence;
     recordmillisec = max_millisec;
 
@@ -288,51 +418,143 @@ bool TestChanAudio::RecordAudioFile(PString &filename,
     record = true;
     sync.Signal();
     recsync.Wait();
-    std::cerr << __func__ << ": recording done " << record << endl;
+
+    // write out what is still queued before reporting back
+    sync.Wait();
+    RecordWriter *writer = recdone;
+    recdone = NULL;
+    sync.Signal();
+
+    bool writeok = writer->Finish();
+    if (writer->GetDroppedFrames())
+        std::cerr << __func__ << ": dropped " << writer->GetDroppedFrames()
+            << " frames (" << writer->GetDroppedBytes()
+            << " bytes), the " << (recstreaming ? "consumer" : "disk")
+            << " could not keep up" << endl;
+    std::cerr << __func__ << ": recording done " << record 
+        << ", wrote " << writer->GetWrittenBytes() << " bytes" << endl;
+    delete writer;
 
     // check if recorded ok
-    bool recordfailed = !record;
+    bool recordfailed = !record  ||  !writeok;
     record = false;
     return !recordfailed;
 
 }
 
+void TestChanAudio::ReceiveFrame(const char *buf, size_t len) {
+  if (!format.IsEncoded()) {
+    DetectDTMF(buf, len);
+    RecordFromBuffer(buf, len, DetectSilence(buf, len));
+    return;
+  }
+
+  if (decoded.size() < len)
+    decoded.resize(len);
+  G711::Decode(LawOf(format.GetEncoding()),
+      reinterpret_cast< const BYTE *>(buf), len, &decoded[0]);
+  const char *pcm = reinterpret_cast< const char *>(&decoded[0]);
+  size_t pcmlen = format.WireToPcmBytes(len);
+  DetectDTMF(pcm, pcmlen);
+  RecordFromBuffer(pcm, pcmlen, DetectSilence(pcm, pcmlen), buf, len);
+}
+
 void TestChanAudio::RecordFromBuffer(
-    const char *buf, size_t len, bool currently_silent) {
+    const char *buf, size_t len, bool currently_silent,
+    const char *wire, size_t wirelen) {
 
   //std::cerr << __func__ << ": begin " << len << endl;
+  if (context.IsEcho())
+    context.GetPlayBackAudio().QueueEcho(buf, len);
+
   AutoSync a(sync);
+  context.GetTimeline().Mark(CallTimeline::RTP_IN);
   // silence detection
-  TPState::Instance().SetSilenceState(currently_silent, len);
-  size_t writecount = 0U;
+  context.SetSilenceState(currently_silent, format.BytesToMillis(len));
+  if(recwriter) {
+    if(recwriter->Failed()) {
+      cerr << __func__ << ": I/O error" << endl;
+      StopAudioRecording(true);
+      return;
+    }
 
-  if(recfile) {
     // check if silent
-    bool is_silent = TPState::Instance().IsSilent(
-        RECORD_SILENCE_TIME_IN_MS * BYTES_PER_MILLIS);
-    size_t recordbytes = recordmillisec * BYTES_PER_MILLIS;
+    bool is_silent = context.IsSilent(RECORD_SILENCE_TIME_IN_MS);
+    size_t recordbytes = format.MillisToBytes(recordmillisec);
     recordbytes = recordbytes > len? len: recordbytes;
 
     // stop on silence?
-    if(!stop_recording_when_silent  &&  is_silent) {
+    if(stop_recording_when_silent  &&  is_silent) {
       std::cerr << __func__ << ": silence detected" << endl;
       StopAudioRecording();
     }
     else {
-      bool ok = recfile->Write(buf, recordbytes);
-      if(ok) {
-          writecount = recfile->GetLastWriteCount();
-          recordmillisec -= writecount / BYTES_PER_MILLIS;
+      // a dropped frame still counts towards the recording time
+      size_t samples = format.BytesToSamples(recordbytes);
+      const char *data = buf;
+      size_t databytes = recordbytes;
+      if(recencoding != AudioProperties::PCM16) {
+        // a code byte per sample, encoded here only if the stream
+        // changed format under the recording
+        if(!wire  ||  wirelen < samples
+            ||  format.GetEncoding() != recencoding) {
+          if(encoded.size() < samples)
+            encoded.resize(samples);
+          G711::Encode(LawOf(recencoding),
+              reinterpret_cast< const short *>(buf), samples, &encoded[0]);
+          wire = reinterpret_cast< const char *>(&encoded[0]);
+        }
+        data = wire;
+        databytes = samples;
       }
-      else {
-          cerr << __func__ << ": I/O error" << endl;
+      if(recstreaming) {
+        BYTE header[RECORD_STREAM_FRAME_HEADER_BYTES];
+        RecordStream::MakeFrameHeader(header, recsamples, databytes);
+        recwriter->Push(header, sizeof(header), data, databytes);
       }
-      if(writecount < len)
-          StopAudioRecording(!ok);
+      else
+        recwriter->Push(data, databytes);
+      recsamples += samples;
+      recordmillisec -= format.BytesToMillis(recordbytes);
+      if(recordbytes < len)
+          StopAudioRecording();
     }
   }
 }
 
+bool TestChanAudio::DetectSilence(const char *buf, size_t len) {
+  return vad.IsSilent(reinterpret_cast< const short *>(buf),
+      format.BytesToSamples(len), format.BytesToMillis(len));
+}
+
+void TestChanAudio::DetectDTMF(const char *buf, size_t len) {
+  // the Goertzel filters are tuned to narrowband
+  if(format.GetSampleRate() != AUDIO_DEFAULT_RATE)
+    return;
+  if(dtmf.Process(reinterpret_cast< const short *>(buf), len / 2, tones))
+    ReportDTMF();
+}
+
+void TestChanAudio::FlushDTMF() {
+  if(dtmf.Flush(tones))
+    ReportDTMF();
+}
+
+void TestChanAudio::ReportDTMF() {
+  for(size_t i = 0; i < tones.size(); i++)
+    std::cout << "receive DTMF: [" << tones[i].digit << "] in-band"
+      << " Start: " << tones[i].start << " ms"
+      << " End: " << tones[i].end << " ms" << std::endl;
+  tones.clear();
+}
+
+void TestChanAudio::SetFormat(const AudioProperties &f) {
+  format = f;
+  vad.Reset();
+  dtmf.Reset();
+  tones.clear();
+}
+
 bool TestChannel::Close() {
     std::cerr << __func__ << " [ " << this->connection 
 	 << " - " << this <<  " ]" << endl;
@@ -350,7 +572,8 @@ bool TestChannel::Read(void *buf, PINDEX len) {
     audiohandle.FillPlaybackBuffer(reinterpret_cast< char *>(buf), len);
 
     lastReadCount = len;
-    readDelay.Delay(len / BYTES_PER_MILLIS);
+    const AudioProperties &format = audiohandle.GetFormat();
+    readDelay.Delay(format.BytesToMillis(format.WireToPcmBytes(len)));
     return true;
 }
 
@@ -360,19 +583,24 @@ bool TestChannel::Write(const void *buf, PINDEX len) {
   // less spam...
   //  std::cerr << "TestChannel::Write" << std::endl;
   
-    audiohandle.RecordFromBuffer(
-            reinterpret_cast< const char *>(buf), len, false);
-            //audiocodec.DetectSilence());
+    audiohandle.ReceiveFrame(reinterpret_cast< const char *>(buf), len);
     lastWriteCount = len;
-    writeDelay.Delay(len / BYTES_PER_MILLIS);
+    const AudioProperties &format = audiohandle.GetFormat();
+    writeDelay.Delay(format.BytesToMillis(format.WireToPcmBytes(len)));
     return true;
 }
 
 LocalConnection::LocalConnection(
         OpalCall &call, LocalEndPoint &ep, void *userData, 
         unsigned opts, OpalConnection::StringOptions *stropts)
-    : OpalLocalConnection(call, ep, userData, opts, stropts) {
+    : OpalLocalConnection(call, ep, userData, opts, stropts),
+    context(static_cast<CallContext *>(userData)) {
         std::cerr << __func__ << std::endl;
+
+        // incoming calls carry no user data, they were bound to a
+        // context by the manager when the call arrived
+        if (!context)
+            context = ep.GetManager().FindContext(call.GetToken());
 }
 
 LocalConnection::~LocalConnection() {
@@ -386,12 +614,21 @@ OpalMediaStream *LocalConnection::CreateMediaStream(
 
     std::cerr << __func__ << std::endl;
 
+    if (!context) {
+        std::cerr << __func__ << ": no call context for "
+            << GetCall().GetToken() << std::endl;
+        return NULL;
+    }
+
     PIndirectChannel *chan = NULL;
 
-    //create the appropriate channel
-    chan = isSource ? 
-         new TestChannel(*this, TPState::Instance().GetPlayBackAudio()) :
-         new TestChannel(*this, TPState::Instance().GetRecordAudio());
+    //create the appropriate channel, its timing follows the format
+    TestChanAudio &audio = isSource ?
+        context->GetPlayBackAudio() : context->GetRecordAudio();
+    audio.SetFormat(AudioProperties::FromMediaFormat(mediaFormat));
+    std::cerr << __func__ << ": " << mediaFormat << " at "
+        << audio.GetFormat().GetSampleRate() << " Hz" << std::endl;
+    chan = new TestChannel(*this, audio);
 
     OpalMediaStream *s = new RawMediaStream(*this, mediaFormat, sessionID, 
             isSource, chan, false);
@@ -23,7 +23,20 @@
 #include <ptlib/syncpoint.h>
 #include <ptclib/delaychan.h>
 #include "includes.h"
+#include "audiocache.h"
+#include "recwriter.h"
+#include "recstream.h"
+#include "playring.h"
+#include "playstream.h"
+#include "rtpsender.h"
+#include "vad.h"
+#include "dtmf.h"
+#include "audioprops.h"
 
+// received audio held for echoing back, power of two: 256 ms
+#define ECHO_RING_BYTES				(1U << 12)
+
+class CallContext;
 
 class AutoSync 
 {
@@ -38,10 +51,17 @@ class AutoSync
 class TestChanAudio 
 {
     public:
-        TestChanAudio() : 
-            playback(false), record(false), 
+        TestChanAudio(CallContext &ctx) : 
+            context(ctx), playback(false), stopplayback(false),
+            playstreaming(false),
+            record(false), 
             stop_recording_when_silent(false), recordmillisec(0U),
-            playfile(NULL), recfile(NULL), playsync(), recsync(), 
+            playasset(), playring(), echoring(ECHO_RING_BYTES),
+            playend(0U), underruns(0UL), format(), rtpsender(NULL),
+            recwriter(NULL), recdone(NULL),
+            recencoding(AudioProperties::PCM16), recstreaming(false),
+            recsamples(0U),
+            recsync(), 
             sync(1U, 1U) {
                 std::cerr << __func__ << std::endl;
             }
@@ -51,49 +71,120 @@ class TestChanAudio
             AutoSync a(sync);
             StopAudioPlayback();
             StopAudioRecording();
+            delete recdone;
+            delete rtpsender;
         }
 
         // playback
         bool PlaybackAudioBuffer(PBYTEArray &buffer);
-        bool PlaybackAudioFile(PString &filename);
+        bool PlaybackAudioFile(const PString &filename);
+        // media thread: never waits, counts an underrun when a prompt
+        // is playing and the ring runs dry
         void FillPlaybackBuffer(char *buf, size_t len);
+        unsigned long GetUnderruns() const { return underruns; }
+        // bytes of the prompt queued ahead of the media thread
+        size_t GetPlaybackQueued() const {
+          return playring.GetWritePosition() - playring.GetReadPosition();
+        }
         void StopPlayback(bool ioerror) {
             AutoSync a(sync);
             StopAudioPlayback(ioerror);
         }
 
         // record
-        bool RecordAudioFile(PString &filename, bool append_file,
+        bool RecordAudioFile(const PString &filename, bool append_file,
                 bool stop_on_silence, int max_millis);
 
+        // records a PCM16 frame; 'wire' is the same frame as received
+        // when that was G.711, recorded as is with --record-encoded
         void RecordFromBuffer(
-                const char *buf, size_t len, bool currently_silent);
+                const char *buf, size_t len, bool currently_silent,
+                const char *wire = NULL, size_t wirelen = 0U);
+
+        // media thread: a frame as received in the stream's encoding,
+        // decoded only for the detectors and PCM recordings
+        void ReceiveFrame(const char *buf, size_t len);
+
+        // G.711 calls record their code bytes instead of PCM16
+        static void SetRecordEncoded(bool e) { recordencoded = e; }
+        static bool IsRecordEncoded() { return recordencoded; }
+
+        // runs the voice activity detector over a received PCM16 frame,
+        // media thread only
+        bool DetectSilence(const char *buf, size_t len);
+
+        // runs the in-band DTMF detector over a received PCM16 frame
+        // and reports finished digits, media thread only
+        void DetectDTMF(const char *buf, size_t len);
+        // reports a digit still sounding as the stream ends and starts
+        // the next stream's times from 0
+        void FlushDTMF();
 
         void StopRecording(bool ioerror) {
             AutoSync a(sync);
             StopAudioRecording(ioerror);
         }
 
+        // queues received audio to be played back while no prompt is,
+        // playback side only, from the record media thread
+        void QueueEcho(const char *buf, size_t len);
+
+        // PCM properties and encoding of the stream, set when it is
+        // opened; the silence and DTMF detectors start afresh with it
+        void SetFormat(const AudioProperties &f);
+        const AudioProperties &GetFormat() const { return format; }
+
+        bool IsPlaying() const { return playback; }
+        bool IsRecording() const { return record; }
+
         // other
         void CloseChannel() {
             std::cerr << "TestChanAudio::CloseChannel" << endl;
             AutoSync a(sync);
             StopAudioPlayback();
             StopAudioRecording();
+            FlushDTMF();
         }
 
     private:
+        CallContext &context;
         volatile bool playback;
+        volatile bool stopplayback;
+        volatile bool playstreaming;
         volatile bool record;
         volatile bool stop_recording_when_silent;
         size_t recordmillisec;
-        PFile *playfile;
-        PFile *recfile;
-        PSyncPoint playsync;
+        AudioAssetPtr playasset;
+        PlaybackRing playring;
+        PlaybackRing echoring;
+        std::atomic< size_t> playend;   // ring position past the prompt
+        std::atomic< unsigned long> underruns;
+        AudioProperties format;
+        RTPSender *rtpsender;
+        RecordWriter *recwriter;
+        RecordWriter *recdone;      // stopped, left for the script to drain
+        AudioProperties::Encoding recencoding;  // of the file being written
+        bool recstreaming;          // to a RecordStream, frames with headers
+        unsigned recsamples;        // offset of the next frame in samples
         PSyncPoint recsync;
         PSemaphore sync;
-
+        VoiceActivityDetector vad;
+        DtmfDetector dtmf;
+        std::vector< DtmfDetector::Tone> tones;
+        // G.711 frames decoded or encoded on the media thread
+        std::vector< short> decoded;
+        std::vector< BYTE> encoded;
+
+        static bool recordencoded;
+
+        void FillPlaybackPCM(char *buf, size_t len);
+        // prints and clears the digits in 'tones'
+        void ReportDTMF();
+        // opens a record file, appending if asked, NULL on failure
+        PFile *OpenRecordFile(const PString &filename, bool append_file);
         bool PlaybackAudio(bool raw_rtp);
+        // plays a PlaybackStream as it arrives, called with sync held
+        bool PlaybackAudioStream(const PString &source, bool raw_rtp);
         void StopAudioPlayback(bool ioerror = false);
         void StopAudioRecording(bool ioerror = false);
 
@@ -175,11 +266,16 @@ class LocalConnection : public OpalLocalConnection
 
         ~LocalConnection();
 
+        CallContext *GetContext() const { return context; }
+
         virtual OpalMediaStream *CreateMediaStream(
                 const OpalMediaFormat & mediaFormat,
                 unsigned sessionID,
                 bool isSource
                 );
+
+    private:
+        CallContext *context;
 };
 
 #endif
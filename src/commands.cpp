@@ -27,73 +27,198 @@
 
 #include "commands.h"
 #include "state.h"
+#include "ttscache.h"
 
 ////
 // Command
 std::string Command::errorstring;
 
-bool Command::Parse(const char *cmds, std::vector< Command*> &sequence) {
+static Call callCommand;
+static Answer answerCommand;
+static Hangup hangupCommand;
+static DTMF dtmfCommand;
+static Voice voiceCommand;
+static Record recordCommand;
+static Wait waitCommand;
+
+Command *Command::Find(char op) {
+  switch(op) {
+    case 'c': return &callCommand;
+    case 'a': return &answerCommand;
+    case 'h': return &hangupCommand;
+    case 'd': return &dtmfCommand;
+    case 'v': return &voiceCommand;
+    case 'r': return &recordCommand;
+    case 'w': return &waitCommand;
+    default: return NULL;
+  }
+}
+
+
+
+////
+// Program
+bool Program::Compile(const char *cmds) {
   const char *ptr = cmds;
-  Command *newcmd = NULL;
+  code.clear();
+  looppc.clear();
+  strings.clear();
+  interned.clear();
+  scope.clear();
+
   while(*ptr) {
-    switch(*ptr) {
-      case 'c':
-	newcmd = new Call();
-	break;
-      case 'a':
-	newcmd = new Answer();
-	break;
-      case 'h':
-	newcmd = new Hangup();
-	break;
-      case 'd':
-	newcmd = new DTMF();
-	break;
-      case 'v':
-	newcmd = new Voice();
-	break;
-      case 'r':
-	newcmd = new Record();
-	break;
-      case 'w':
-	newcmd = new Wait();
-	break;
-      case 'l':
-	newcmd = new Label();
-	break;
-      case 'j':
-	newcmd = new Loop();
-	break;
-      default:
-	newcmd = NULL;
-	break;
-    };
-    ptr++;
-    if(newcmd) {
-      if(!newcmd->ParseCommand(&ptr, sequence))
+    char op = *ptr++;
+    if(op == 'l') {
+      if(!CompileLabel(&ptr))
 	return false;
+      continue;
     }
+    if(op == 'j') {
+      if(!CompileLoop(&ptr))
+	return false;
+      continue;
+    }
+    Command *handler = Command::Find(op);
+    if(!handler)
+      continue;
+
+    Instruction instr = Instruction();
+    instr.op = op;
+    if(!handler->ParseCommand(&ptr, instr, *this))
+      return false;
+    Item item = { (unsigned)code.size(), (unsigned)code.size(), -1 };
+    scope.push_back(item);
+    code.push_back(instr);
   }
+
+  // only needed while compiling
+  scope.clear();
+  interned.clear();
   return true;
 }
 
-bool Command::Run(
-    std::vector< Command*> &sequence, const std::string &loopsuffix) {
+bool Program::CompileLabel(const char **cmds) {
+  size_t i = 0U;
+  for(; (*cmds)[i]  &&  (*cmds)[i] != ';'; i++);
+  if(!i) {
+    Command::SetErrorString("Label: Empty label specified");
+    return false;
+  }
+  Item item = { (unsigned)code.size(), (unsigned)code.size(),
+    (int)Intern(PString(*cmds, i)) };
+  scope.push_back(item);
+  *cmds = &((*cmds)[i]);
+  return true;
+}
+
+bool Program::CompileLoop(const char **cmds) {
+  unsigned loops = 1U;
+  size_t numdigits = strspn(*cmds, "0123456789");
+  if(numdigits  &&  numdigits < 8)
+    sscanf(*cmds, "%u", &loops);
+  (*cmds) += numdigits;
 
-  std::vector< Command*>::iterator it = sequence.begin();
-  for(; it != sequence.end(); it++)
-    if(!(*it)->RunCommand(loopsuffix))
+  int label = -1;
+  if(tolower(**cmds) == 'l') {
+    (*cmds)++;
+    size_t i = 0U;
+    for(; (*cmds)[i]  &&  (*cmds)[i] != ';'; i++)
+      ;
+    if(!i) {
+      Command::SetErrorString("Loop: Empty label specified");
+      return false;
+    }
+    label = Intern(PString(*cmds, i));
+    (*cmds) += i;
+  }
+  else if(**cmds  &&  **cmds != ';') {
+    Command::SetErrorString(
+        "Loop: invalid characters after iteration count");
+    return false;
+  }
+
+  // the body is everything after the label, or everything at this
+  // nesting level without one. Items taken into the body leave the
+  // scope, so each is scanned only once over the whole program.
+  size_t n = scope.size();
+  if(label >= 0) {
+    for(; n > 0  &&  scope[n - 1].label != label; n--)
+      ;
+    if(!n) {
+      Command::SetErrorString("Loop: Nonexistant label specified");
       return false;
+    }
+  }
+  else
+    n = 0;
+
+  unsigned id = looppc.size();
+  unsigned start = n < scope.size()? scope[n].start: code.size();
+  for(size_t k = n; k < scope.size(); k++)
+    if(scope[k].label < 0)
+      code[scope[k].pc].loop = id + 1;
+  scope.resize(n);
+
+  Instruction instr = Instruction();
+  instr.op = 'j';
+  instr.arg = loops;
+  instr.operand = id;
+  instr.target = start;
+  Item item = { start, (unsigned)code.size(), -1 };
+  looppc.push_back(code.size());
+  code.push_back(instr);
+  scope.push_back(item);
+  return true;
+}
 
+bool Program::Run(CallContext &ctx) const {
+
+  std::vector< unsigned> iterations(looppc.size(), 0U);
+  size_t pc = 0U;
+  while(pc < code.size()) {
+    const Instruction &instr = code[pc];
+    if(instr.op == 'j') {
+      unsigned &iteration = iterations[instr.operand];
+      if(++iteration < instr.arg) {
+	std::cerr << "Loop: iteration " << iteration
+	  << "/" << instr.arg << endl;
+	pc = instr.target;
+      }
+      else {
+	// ready for the next time the loop is entered
+	iteration = 0U;
+	pc++;
+      }
+      continue;
+    }
+    if(!Command::Find(instr.op)->RunCommand(
+	  ctx, instr, *this, iterations))
+      return false;
+    pc++;
+  }
   return true;
 }
 
-void Command::DeleteSequence(std::vector< Command*> &sequence) {
+unsigned Program::Intern(const PString &s) {
+  std::string key((const char *)s);
+  std::map< std::string, unsigned>::iterator it = interned.find(key);
+  if(it != interned.end())
+    return it->second;
+  unsigned index = strings.size();
+  strings.push_back(s);
+  interned[key] = index;
+  return index;
+}
 
-  while(!sequence.empty()) {
-    delete sequence[0];
-    sequence.erase(sequence.begin());
+std::string Program::GetLoopSuffix(const Instruction &instr,
+    const std::vector< unsigned> &iterations) const {
+  std::string suffix;
+  char buf[16];
+  for(unsigned l = instr.loop; l; l = code[looppc[l - 1]].loop) {
+    snprintf(buf, sizeof(buf), "_%u", iterations[l - 1]);
+    suffix.insert(0, buf);
   }
+  return suffix;
 }
 
 
@@ -101,7 +226,7 @@ void Command::DeleteSequence(std::vector< Command*> &sequence) {
 ////
 // Call
 bool Call::ParseCommand(
-    const char **cmds, std::vector< Command*> &sequence) {
+    const char **cmds, Instruction &instr, Program &program) {
   size_t i = 0U;
   for(; (*cmds)[i]  &&  (*cmds)[i] != ';'; i++)
     ;
@@ -112,21 +237,22 @@ bool Call::ParseCommand(
     return false;
   }
 
-  remoteparty = PString(*cmds, i);
+  instr.operand = program.Intern(PString(*cmds, i));
   *cmds = &((*cmds)[i]);
-  sequence.push_back(this);
   return true;
 }
 
-bool Call::RunCommand(const std::string &loopsuffix) {
+bool Call::RunCommand(
+    CallContext &ctx, const Instruction &instr,
+    const Program &program, const std::vector< unsigned> &iterations) {
   std::cerr << "## Call ##" << std::endl;
   // set up
   PString token;
-  TPState &tpstate = TPState::Instance();
+  CallContext &tpstate = ctx;
 
   // concatenate gw to remote party name
   // if one has been specified and there is no address for username
-  PString rp = remoteparty;
+  PString rp = program.GetString(instr.operand);
   PString gw = TPState::Instance().GetGateway();
   char buf[256];
   time_t secsnow = time(NULL);
@@ -153,12 +279,12 @@ bool Call::RunCommand(const std::string &loopsuffix) {
 
   // dial out
   TPState::TPConnState state = TPState::CONNECTING;
-  if (!TPState::Instance().GetManager()->MakeCall(rp))
+  if (!TPState::Instance().GetManager()->MakeCall(ctx, rp))
     return false;
   
   // wait for connection (or termination)
   // rtp does not change state via callback, we can skip the following.
-  if (tpstate.GetProtocol() != TPState::RTP)
+  if (TPState::Instance().GetProtocol() != TPState::RTP)
     tpstate.SetState(state);
 
   secsnow_pre = difftime(time(NULL), secsnow);
@@ -177,11 +303,11 @@ bool Call::RunCommand(const std::string &loopsuffix) {
     
     if(state == TPState::TERMINATED) 
     {
-      errorstring = "Call: application terminated";
+      ctx.SetErrorString("Call: application terminated");
       return false;
     } else if (difftime(time(NULL), secsnow) > DIAL_TIMEOUT) 
     {
-      errorstring = "Call: Dial timed out, check -T / --dialtimeout command line option";
+      ctx.SetErrorString("Call: Dial timed out, check -T / --dialtimeout command line option");
       return false;
     }
   } while(state == TPState::CONNECTING);
@@ -201,23 +327,21 @@ bool Call::RunCommand(const std::string &loopsuffix) {
 ////
 // Answer
 bool Answer::ParseCommand(
-    const char **cmds, std::vector< Command*> &sequence) {
+    const char **cmds, Instruction &instr, Program &program) {
 
   size_t i = 0U;
   for(; (*cmds)[i]  &&  (*cmds)[i] != ';'; i++)
     ;
 
-  if(i) 
-    expectedparty = PString(*cmds, i);
+  instr.operand = program.Intern(PString(*cmds, i));
 
   *cmds = &((*cmds)[i]);
-  sequence.push_back(this);
-
-  TPState::Instance().GetManager()->SetListenMode(true);
   return true;
 }
 
-bool Answer::RunCommand(const std::string &loopsuffix) {
+bool Answer::RunCommand(
+    CallContext &ctx, const Instruction &instr,
+    const Program &program, const std::vector< unsigned> &iterations) {
   std::cerr << "## Answer ##" << std::endl;
   char buf[256];
   time_t secsnow = time(NULL);
@@ -225,21 +349,26 @@ bool Answer::RunCommand(const std::string &loopsuffix) {
 
   // set up
   PString token;
-  TPState &tpstate = TPState::Instance();
+  CallContext &tpstate = ctx;
+  Manager *manager = TPState::Instance().GetManager();
 
   // Start listener thread
   TPState::TPConnState state = TPState::CONNECTING;
   tpstate.SetState(state);
+  tpstate.SetListening(true);
 
-  if (!tpstate.GetManager()->IsListenerUp() && 
-      !tpstate.GetManager()->StartListener())
+  if (!manager->IsListenerUp() && 
+      !manager->StartListener()) {
+    tpstate.SetListening(false);
     return false;
+  }
 
   // wait for connection (or termination)
   do {
     state = tpstate.WaitForStateChange(TPState::ESTABLISHED);
     if(state == TPState::TERMINATED) {
-      errorstring = "Answer: application terminated";
+      tpstate.SetListening(false);
+      ctx.SetErrorString("Answer: application terminated");
       return false;
     }
   } while(state == TPState::CONNECTING);
@@ -254,25 +383,25 @@ bool Answer::RunCommand(const std::string &loopsuffix) {
 ////
 // Hangup
 bool Hangup::ParseCommand(
-    const char **cmds, std::vector< Command*> &sequence) {
+    const char **cmds, Instruction &instr, Program &program) {
   
   for(; **cmds  &&  **cmds != ';'; (*cmds)++)
     ;
   
-  sequence.push_back(this);
   return true;
 }
 
-bool Hangup::RunCommand(const std::string &loopsuffix) {
+bool Hangup::RunCommand(
+    CallContext &ctx, const Instruction &instr,
+    const Program &program, const std::vector< unsigned> &iterations) {
 
   std::cerr << "## Hangup ##" << std::endl;
   char buf[256];
   time_t secsnow = time(NULL);
   std::cerr << "Hangup: at " << ctime_r(&secsnow, buf) << endl;
-  TPState &tpstate = TPState::Instance();
 
   // hangup
-  tpstate.GetManager()->ClearAllCalls();
+  TPState::Instance().GetManager()->Hangup(ctx);
   return true;
 }
 
@@ -281,7 +410,7 @@ bool Hangup::RunCommand(const std::string &loopsuffix) {
 ////
 // DTMF
 bool DTMF::ParseCommand(
-    const char **cmds, std::vector< Command*> &sequence) {
+    const char **cmds, Instruction &instr, Program &program) {
 
   size_t i = 0U;
   for(; (*cmds)[i]  &&  (*cmds)[i] != ';'
@@ -293,24 +422,26 @@ bool DTMF::ParseCommand(
     return false;
   }
 
-  digits = PString(*cmds, i);
+  instr.operand = program.Intern(PString(*cmds, i));
   *cmds = &((*cmds)[i]);
-  sequence.push_back(this);
   return true;
 }
 
-bool DTMF::RunCommand(const std::string &loopsuffix) {
+bool DTMF::RunCommand(
+    CallContext &ctx, const Instruction &instr,
+    const Program &program, const std::vector< unsigned> &iterations) {
 
+    const PString &digits = program.GetString(instr.operand);
     std::cerr << "## DTMF \"" << digits << "\" ##" << endl;
     return
-      TPState::Instance().GetManager()->SendDTMF(digits);
+      TPState::Instance().GetManager()->SendDTMF(ctx, digits);
 }
 
 
 ////
 // Voice
 bool Voice::ParseCommand(
-    const char **cmds, std::vector< Command*> &sequence) {
+    const char **cmds, Instruction &instr, Program &program) {
   size_t i = 0U;
   for(; (*cmds)[i]  &&  (*cmds)[i] != ';'; i++);
   if(!i) {
@@ -318,28 +449,41 @@ bool Voice::ParseCommand(
     return false;
   }
 
-  audiofilename = PString(*cmds, i);
+  instr.operand = program.Intern(PString(*cmds, i));
   *cmds = &((*cmds)[i]);
-  sequence.push_back(this);
   return true;
 }
 
-bool Voice::RunCommand(const std::string &loopsuffix) {
-
+bool Voice::RunCommand(
+    CallContext &ctx, const Instruction &instr,
+    const Program &program, const std::vector< unsigned> &iterations) {
+  const PString &audiofilename = program.GetString(instr.operand);
   std::cerr << "## Voice audiofile="<< audiofilename << " ##" << std::endl;
 
+  // text is rendered (or found in the cache) before playback starts
+  PString source = audiofilename;
+  if(TtsCache::IsTextSource(audiofilename)) {
+    source = TtsCache::Instance().Get(audiofilename.Mid(4),
+        ctx.GetPlayBackAudio().GetFormat().GetSampleRate());
+    if(source.IsEmpty()) {
+      std::string t = audiofilename.Mid(4);
+      ctx.SetErrorString("Voice: cannot render text \"" + t + "\"");
+      return false;
+    }
+  }
+
   // playback audio
    bool ok = 
-       TPState::Instance().GetPlayBackAudio().PlaybackAudioFile(audiofilename);
+       ctx.GetPlayBackAudio().PlaybackAudioFile(source);
 
   // check result
-  if(TPState::Instance().GetState() == TPState::TERMINATED) {
-    errorstring = "Voice: application terminated";
+  if(ctx.GetState() == TPState::TERMINATED) {
+    ctx.SetErrorString("Voice: application terminated");
     return false;
   }
   if(!ok) {
     std::string f = audiofilename;
-    errorstring = "Voice: error reading file \"" + f + "\"";
+    ctx.SetErrorString("Voice: error reading file \"" + f + "\"");
   }
   return ok;
 }
@@ -349,25 +493,20 @@ bool Voice::RunCommand(const std::string &loopsuffix) {
 ////
 // Record
 bool Record::ParseCommand(
-    const char **cmds, std::vector< Command*> &sequence) {
+    const char **cmds, Instruction &instr, Program &program) {
   size_t optsize = strcspn(*cmds, "0123456789;");
   if(optsize) {
     // append
-    append = memchr(*cmds, 'a', optsize);
-    if(!append)
-      append = memchr(*cmds, 'A', optsize);
+    if(memchr(*cmds, 'a', optsize)  ||  memchr(*cmds, 'A', optsize))
+      instr.flags |= APPEND;
     // silence
-    silence = memchr(*cmds, 's', optsize);
-    if(!silence)
-      silence = memchr(*cmds, 'S', optsize);
+    if(memchr(*cmds, 's', optsize)  ||  memchr(*cmds, 'S', optsize))
+      instr.flags |= SILENCE;
     // iteration-based naming
-    iterationsuffix = memchr(*cmds, 'i', optsize);
-    if(!iterationsuffix)
-      iterationsuffix = memchr(*cmds, 'I', optsize);
+    if(memchr(*cmds, 'i', optsize)  ||  memchr(*cmds, 'I', optsize))
+      instr.flags |= ITERATIONSUFFIX;
     *cmds += optsize;
   }
-  else
-    append = silence = iterationsuffix = false;
   // millis
   size_t i = 0U;
   for(; (*cmds)[i]  &&  (*cmds)[i] != ';'  &&  isdigit((*cmds)[i]); i++);
@@ -375,7 +514,7 @@ bool Record::ParseCommand(
     errorstring = "Record: No digits or invalid digits specified";
     return false;
   }
-  sscanf(*cmds, "%u", &millis);
+  sscanf(*cmds, "%u", &instr.arg);
   *cmds = &((*cmds)[i]);
   // filename
   for(i = 0U; (*cmds)[i]  &&  (*cmds)[i] != ';'; i++);
@@ -383,16 +522,23 @@ bool Record::ParseCommand(
     errorstring = "Record: empty audio filename";
     return false;
   }
-  audiofilename = PString(*cmds, i);
+  PString target(*cmds, i);
+  // audio on stdout, so the text that would go there goes to stderr
+  if(target == "-")
+    RecordStream::ClaimStdout();
+  instr.operand = program.Intern(target);
   *cmds = &((*cmds)[i]);
-  sequence.push_back(this);
   return true;
 }
 
-bool Record::RunCommand(const std::string &loopsuffix) {
+bool Record::RunCommand(
+    CallContext &ctx, const Instruction &instr,
+    const Program &program, const std::vector< unsigned> &iterations) {
   // create filename
+  const PString &audiofilename = program.GetString(instr.operand);
   PString filename;
-  if(iterationsuffix) {
+  if((instr.flags & ITERATIONSUFFIX)  &&  audiofilename != "-") {
+    std::string loopsuffix = program.GetLoopSuffix(instr, iterations);
     PINDEX fn = audiofilename.FindLast('/');
     PINDEX ext = audiofilename.Find('.', fn == P_MAX_INDEX? 0: fn);
     if(ext == P_MAX_INDEX)
@@ -408,17 +554,17 @@ bool Record::RunCommand(const std::string &loopsuffix) {
   
   // record audio
   bool ok = 
-    TPState::Instance().GetRecordAudio().RecordAudioFile(
-        filename, append, silence, millis);
+    ctx.GetRecordAudio().RecordAudioFile(
+        filename, instr.flags & APPEND, instr.flags & SILENCE, instr.arg);
   
   // check result
-  if(TPState::Instance().GetState() == TPState::TERMINATED) {
-    errorstring = "Record: application terminated";
+  if(ctx.GetState() == TPState::TERMINATED) {
+    ctx.SetErrorString("Record: application terminated");
     return false;
   }
   if(!ok) {
     std::string f = filename;
-    errorstring = "Record: error writing file \"" + f + "\"";
+    ctx.SetErrorString("Record: error writing file \"" + f + "\"");
   }
   return ok;
 }
@@ -428,17 +574,20 @@ bool Record::RunCommand(const std::string &loopsuffix) {
 ////
 // Wait
 bool Wait::ParseCommand(
-    const char **cmds, std::vector< Command*> &sequence) {
-  silence = (tolower(**cmds) == 's');
-  activity = (tolower(**cmds) == 'a');
-  
-  if(silence  ||  activity) 
+    const char **cmds, Instruction &instr, Program &program) {
+  if(tolower(**cmds) == 's') {
+    instr.flags |= SILENCE;
     (*cmds)++;
+  }
+  else if(tolower(**cmds) == 'a') {
+    instr.flags |= ACTIVITY;
+    (*cmds)++;
+  }
   
-  closed = (tolower(**cmds) == 'c');
-  
-  if(closed) 
+  if(tolower(**cmds) == 'c') {
+    instr.flags |= CLOSED;
     (*cmds)++;
+  }
   
   size_t i = 0U;
   for(; (*cmds)[i]  &&  (*cmds)[i] != ';'  &&  isdigit((*cmds)[i]); i++)
@@ -449,147 +598,57 @@ bool Wait::ParseCommand(
     return false;
   }
 
-  sscanf(*cmds, "%u", &millis);
+  sscanf(*cmds, "%u", &instr.arg);
   *cmds = &((*cmds)[i]);
-  sequence.push_back(this);
   return true;
 }
 
-bool Wait::RunCommand(const std::string &loopsuffix) {
+bool Wait::RunCommand(
+    CallContext &ctx, const Instruction &instr,
+    const Program &program, const std::vector< unsigned> &iterations) {
 
+  const unsigned millis = instr.arg;
+  const bool silence = instr.flags & SILENCE;
+  const bool activity = instr.flags & ACTIVITY;
+  const bool closed = instr.flags & CLOSED;
   std::cerr << "## Wait: waiting for " << millis << "ms ##" << endl;
-  for(int n = millis / WAIT_SLEEP_ACCURACY; n >= 0; n--) {
+  const PInt64 deadline = PTimer::Tick().GetMilliSeconds() + millis;
+  for(;;) {
+    const unsigned long seen = ctx.GetEventCount();
     // silence detection
     if(silence
-        &&  TPState::Instance().IsSilent(
-	  WAIT_SILENCE_TIME_IN_MS * BYTES_PER_MILLIS)) {
+        &&  ctx.IsSilent(WAIT_SILENCE_TIME_IN_MS)) {
       std::cerr << "Wait: silence detected" << endl;
       break;
     }
     // activity detection
     else if(activity
-        &&  TPState::Instance().IsActive(
-          WAIT_ACTIVITY_TIME_IN_MS * BYTES_PER_MILLIS)) {
+        &&  ctx.IsActive(WAIT_ACTIVITY_TIME_IN_MS)) {
       std::cerr << "Wait: activity detected" << endl;
       break;
     }
     // disconnect detection
     if(closed
-        &&  (TPState::Instance().GetState() == TPState::TERMINATED
-          ||  TPState::Instance().GetState() == TPState::CLOSED)) {
+        &&  (ctx.GetState() == TPState::TERMINATED
+          ||  ctx.GetState() == TPState::CLOSED)) {
       std::cerr << "Wait: connection closed" << endl;
       return true;
     }
-    //std::cerr << "Wait: usleep " << n << endl;
-    usleep(WAIT_SLEEP_ACCURACY * 1000);
     if(!closed
-        &&  TPState::Instance().GetState() == TPState::TERMINATED) {
-      errorstring = "Wait: application terminated";
+        &&  ctx.GetState() == TPState::TERMINATED) {
+      ctx.SetErrorString("Wait: application terminated");
       return false;
     }
+    // sleep until something changes or the time is up
+    PInt64 left = deadline - PTimer::Tick().GetMilliSeconds();
+    if(left <= 0)
+      break;
+    ctx.WaitForEvent(seen, left);
   }
   std::cerr << "Wait: wait done" << endl;
   return true;
 }
 
 
-////
-// Label
-bool Label::ParseCommand(
-    const char **cmds, std::vector< Command*> &sequence) {
-  size_t i = 0U;
-  for(; (*cmds)[i]  &&  (*cmds)[i] != ';'; i++);
-  if(!i) {
-    errorstring = "Label: Empty label specified";
-    return false;
-  }
-  label = PString(*cmds, i);
-  *cmds = &((*cmds)[i]);
-  sequence.push_back(this);
-  return true;
-}
-
-
-
-////
-// Loop
-bool Loop::PopToInnerSequence(
-    PString &label, std::vector< Command*> &sequence) {
-
-  while(!sequence.empty()) {
-    Command *cmd = *(sequence.rbegin());
-    Label *alabel = dynamic_cast< Label *>(cmd);
-    if(alabel  &&  label == alabel->GetLabel()) {
-      return true;
-    }
-    sequence.pop_back();
-    loopedsequence.insert(loopedsequence.begin(), cmd);
-  }
-  if(sequence.empty()  &&  label.IsEmpty()) {
-    return true;
-  }
-  errorstring = "Loop: Nonexistant label specified";
-  return false;
-}
-
-bool Loop::ParseCommand(
-    const char **cmds, std::vector< Command*> &sequence) {
-
-  size_t numdigits = strspn(*cmds, "0123456789");
-  if(numdigits  &&  numdigits < 8)
-    sscanf(*cmds, "%d", &loops);
-
-  (*cmds) += numdigits;
-  if(tolower(**cmds) == 'l') {
-    (*cmds)++;
-    size_t i = 0U;
-    
-    for(; (*cmds)[i]  &&  (*cmds)[i] != ';'; i++)
-      ;
-
-    if(!i) {
-      errorstring = "Loop: Empty label specified";
-    }
-    else {
-      PString l = PString(*cmds, i);
-      if(PopToInnerSequence(l, sequence)) {
-        (*cmds) += i;
-        sequence.push_back(this);
-        return true;
-      }
-    }
-  }
-  else if(**cmds == ';'  ||  !**cmds) {
-    PString l = "";
-    if(PopToInnerSequence(l, sequence)) {
-      sequence.push_back(this);
-      return true;
-    }
-  }
-  else {
-    errorstring = "Loop: invalid characters after iteration count";
-  }
-  return false;
-}
-
-bool Loop::RunCommand(const std::string &loopsuffix) {
-
-  int timesleft = 0;
-  do {
-    char buf[256];
-    time_t secsnow = time(NULL);
-    stringstream newsuffix;
-    newsuffix << loopsuffix << "_" << timesleft;
-    std::cerr << "Loop: iteration \"" << newsuffix.str()
-      << "\" at " << ctime_r(&secsnow, buf) << endl;
-
-    if(!Command::Run(loopedsequence, newsuffix.str()))
-      return false;
-  
-  } while(++timesleft < loops);
-  return true;
-}
-
-
 //**// END OF FILE //**//
 // vim: tw=78 sw=2 sts=2
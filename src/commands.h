@@ -23,11 +23,76 @@
 
 #include <string>
 #include <vector>
+#include <map>
 #include <ptlib.h>
 extern int DIAL_TIMEOUT;
 
+class CallContext;
+class Program;
+
 // See README.txt for <prog> syntax.
 
+// One compiled command. Labels do not produce instructions, a loop is a
+// single backward jump to the first instruction of its body.
+struct Instruction {
+  unsigned char op;	// command character, 'j' for loops
+  unsigned char flags;	// command options, see below
+  unsigned arg;		// millis or loop count
+  unsigned operand;	// interned string, or the id of a loop
+  unsigned target;	// loop: pc of the first instruction of the body
+  unsigned loop;	// innermost enclosing loop id + 1, 0 if none
+};
+
+// A -x program compiled into a flat instruction array. Strings are
+// interned once. A compiled program is never modified when run, so
+// several calls can run it at once.
+class Program {
+  public:
+    Program() { }
+
+    // compiles the command string, returns whether successful or not
+    // -errors are left in Command::GetErrorString()
+    bool Compile( const char *cmds);
+
+    // runs the program for one call
+    // -returns whether successful or not, errors are left in the context
+    bool Run( CallContext &ctx) const;
+
+    size_t GetSize( void) const { return code.size(); }
+
+    // interns a string, returns its index
+    unsigned Intern( const PString &s);
+    const PString &GetString( unsigned index) const {
+      return strings[index];
+    }
+
+    // "_<outer>_..._<inner>" iteration suffix of an instruction
+    std::string GetLoopSuffix( const Instruction &instr,
+        const std::vector< unsigned> &iterations) const;
+
+  private:
+    // a command, label or closed loop at the current nesting level
+    struct Item {
+      unsigned start;	// first pc of the item
+      unsigned pc;	// instruction to attach to the enclosing loop
+      int label;	// interned label, -1 if not a label
+    };
+
+    bool CompileLabel( const char **cmds);
+    bool CompileLoop( const char **cmds);
+
+    std::vector< Instruction> code;
+    std::vector< unsigned> looppc;
+    std::vector< PString> strings;
+    std::map< std::string, unsigned> interned;
+    std::vector< Item> scope;
+
+    Program(const Program&);
+    Program operator=(Program&);
+};
+
+// Parses and runs one kind of command. Handlers are stateless, there is
+// one per command character; the parsed data lives in the instruction.
 class Command {
   protected:
     static std::string errorstring;
@@ -35,87 +100,73 @@ class Command {
   public:
     virtual ~Command() { }
 
-    // parses command sequence
-    static bool Parse( const char *cmds, std::vector< Command*> &sequence);
+    // returns the handler for a command character, NULL if none
+    static Command *Find( char op);
 
-    // runs command sequence
-    // -returns whether successful or not
-    static bool Run(
-        std::vector< Command*> &sequence,
-        const std::string &loopsuffix = "");
-
-    // deletes all commands in the sequence
-    static void DeleteSequence( std::vector< Command*> &sequence);
-    
-    // returns the error message
+    // returns the parse error message
     static const std::string &GetErrorString( void) {
       return errorstring;
     }
+    static void SetErrorString( const std::string &e) {
+      errorstring = e;
+    }
     
     // parses this command
-    // -appends command to the vector
+    // -fills in the instruction
     // -increments cmds pointer
     // -returns whether successful or not
     virtual bool ParseCommand(
-        const char **cmds, std::vector< Command*> &sequence) = 0;
+        const char **cmds, Instruction &instr, Program &program) = 0;
     
-    // runs command
+    // runs command in the given call context
+    // -iterations hold the current iteration of each loop
     // -returns whether successful or not
-    virtual bool RunCommand( const std::string &loopsuffix = "") = 0;
+    virtual bool RunCommand(
+        CallContext &ctx, const Instruction &instr,
+        const Program &program,
+        const std::vector< unsigned> &iterations) = 0;
 };
 
+#define COMMAND_METHODS \
+  bool ParseCommand( \
+      const char **cmds, Instruction &instr, Program &program); \
+  bool RunCommand( \
+      CallContext &ctx, const Instruction &instr, \
+      const Program &program, const std::vector< unsigned> &iterations);
+
 
 // call	    := 'c' remoteparty
 class Call : public Command {
-  private:
-    PString remoteparty;
-
   public:
-    bool ParseCommand( const char **cmds, std::vector< Command*> &sequence);
-    bool RunCommand( const std::string &loopsuffix = "");
+    COMMAND_METHODS
 };
 
 
 // answer   := 'a' [ expectedremoteparty ]
 class Answer : public Command {
-  private:
-    PString expectedparty;
-  
   public:
-    bool ParseCommand( const char **cmds, std::vector< Command*> &sequence);
-    bool RunCommand( const std::string &loopsuffix = "");
+    COMMAND_METHODS
 };
 
 
 // hangup   := 'h'
 class Hangup : public Command {
-  private:
-  
   public:
-    bool ParseCommand( const char **cmds, std::vector< Command*> &sequence);
-    bool RunCommand( const std::string &loopsuffix = "");
+    COMMAND_METHODS
 };
 
 
 // dtmf	    := 'd' digits
 class DTMF : public Command {
-  private:
-    PString digits;
-  
   public:
-    bool ParseCommand( const char **cmds, std::vector< Command*> &sequence);
-    bool RunCommand( const std::string &loopsuffix = "");
+    COMMAND_METHODS
 };
 
 
 // voice    := 'v' Wav-audiofile
 class Voice : public Command {
-  private:
-    PString audiofilename;
-  
   public:
-    bool ParseCommand( const char **cmds, std::vector< Command*> &sequence);
-    bool RunCommand( const std::string &loopsuffix = "");
+    COMMAND_METHODS
 };
 
 
@@ -124,16 +175,13 @@ class Voice : public Command {
 // silence  :=  's'
 // iter	    :=  'i'
 class Record : public Command {
-  private:
-    bool append;
-    bool silence;
-    bool iterationsuffix;
-    PString audiofilename;
-    int millis;
-  
   public:
-    bool ParseCommand( const char **cmds, std::vector< Command*> &sequence);
-    bool RunCommand( const std::string &loopsuffix = "");
+    enum {
+      APPEND = 1,
+      SILENCE = 2,
+      ITERATIONSUFFIX = 4
+    };
+    COMMAND_METHODS
 };
 
 
@@ -142,49 +190,18 @@ class Record : public Command {
 // silence  := 's'
 // closed   := 'c'
 class Wait : public Command {
-  private:
-    bool activity;
-    bool silence;
-    bool closed;
-    size_t millis;
-
-
   public:
-    bool ParseCommand( const char **cmds, std::vector< Command*> &sequence);
-    bool RunCommand( const std::string &loopsuffix = "");
+    enum {
+      ACTIVITY = 1,
+      SILENCE = 2,
+      CLOSED = 4
+    };
+    COMMAND_METHODS
 };
 
-
 // setlabel := 'l' label
-class Label : public Command {
-  private:
-    PString label;
-
-  public:
-    bool ParseCommand( const char **cmds, std::vector< Command*> &sequence);
-    bool RunCommand( const std::string &loopsuffix = "") { return true; }
-    const PString &GetLabel() const {
-      return label;
-    }
-};
-
 // loop	    := 'j' [ how-many-times ] [ 'l' label ]
-class Loop : public Command {
-  private:
-    int loops;
-    std::vector< Command*> loopedsequence;
-
-    bool PopToInnerSequence(
-        PString &label, std::vector< Command*> &sequence);
-
-  public:
-    ~Loop() {
-      Command::DeleteSequence( loopedsequence);
-    }
-
-    bool ParseCommand( const char **cmds, std::vector< Command*> &sequence);
-    bool RunCommand( const std::string &loopsuffix = "");
-};
+// are compiled by Program
 
 #endif // COMMANDS_H
 //**// END OF FILE //**//
@@ -0,0 +1,313 @@
+/*
+ * sipcmd, dtmf.cpp
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#include <cmath>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include "dtmf.h"
+
+// 20 ms blocks at 8 kHz, 50 Hz resolution
+#define DTMF_BLOCK_SAMPLES			160U
+#define DTMF_BLOCK_MILLIS			20U
+// weakest tone accepted, -36 dBFS amplitude
+#define DTMF_MIN_AMPLITUDE			(32768.0 * 0.0158)
+// column tone may be up to 8 dB above the row tone, row up to 4 dB
+// above the column tone
+#define DTMF_TWIST_NORMAL			6.31
+#define DTMF_TWIST_REVERSE			2.51
+// the other frequencies of a group must be 6 dB below the peak
+#define DTMF_RELATIVE_PEAK			4.0
+// share of the block energy in the two tones, a clean pair gives 0.5
+#define DTMF_MIN_TONE_RATIO			0.35
+
+// in-band tone levels, the column tone 2 dB above the row tone
+#define DTMF_ROW_AMPLITUDE			7000.0
+#define DTMF_COL_AMPLITUDE			8800.0
+
+static const double dtmffreq[8] = {
+  697.0, 770.0, 852.0, 941.0, 1209.0, 1336.0, 1477.0, 1633.0
+};
+
+static const float dtmfcoef[8] = {
+  // 2 cos(2 pi f / 8000) for 697, 770, 852, 941 Hz
+  1.7077378f, 1.6452810f, 1.5686870f, 1.4782046f,
+  // and 1209, 1336, 1477, 1633 Hz
+  1.1641040f, 0.9963702f, 0.7986184f, 0.5685327f
+};
+
+static const char dtmfkeys[4][4] = {
+  { '1', '2', '3', 'A' },
+  { '4', '5', '6', 'B' },
+  { '7', '8', '9', 'C' },
+  { '*', '0', '#', 'D' }
+};
+
+DtmfDetector::DtmfDetector()
+{
+  Reset();
+}
+
+void DtmfDetector::Reset()
+{
+  for (unsigned i = 0; i < 8; i++)
+    s1[i] = s2[i] = 0.0f;
+  energy = 0.0;
+  blockpos = 0U;
+  blocks = 0UL;
+  candidate = current = 0;
+  firstblock = lastblock = 0UL;
+}
+
+size_t DtmfDetector::Flush(std::vector< Tone> &tones)
+{
+  size_t found = tones.size();
+  if (current) {
+    Tone tone = { current,
+      (unsigned)(firstblock * DTMF_BLOCK_MILLIS),
+      (unsigned)((lastblock + 1) * DTMF_BLOCK_MILLIS) };
+    tones.push_back(tone);
+  }
+  Reset();
+  return tones.size() - found;
+}
+
+size_t DtmfDetector::Process(const short *x, size_t n,
+    std::vector< Tone> &tones)
+{
+  size_t found = tones.size();
+  size_t i = 0U;
+  while (i < n) {
+    size_t end = i + (DTMF_BLOCK_SAMPLES - blockpos);
+    if (end > n)
+      end = n;
+    blockpos += end - i;
+
+#if defined(__SSE2__)
+    // all eight filters advance one sample per iteration
+    const __m128 clo = _mm_loadu_ps(dtmfcoef);
+    const __m128 chi = _mm_loadu_ps(dtmfcoef + 4);
+    __m128 s1lo = _mm_loadu_ps(s1), s1hi = _mm_loadu_ps(s1 + 4);
+    __m128 s2lo = _mm_loadu_ps(s2), s2hi = _mm_loadu_ps(s2 + 4);
+    float e = 0.0f;
+    for (; i < end; i++) {
+      float sample = x[i];
+      __m128 v = _mm_set1_ps(sample);
+      __m128 lo = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(clo, s1lo), s2lo), v);
+      __m128 hi = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(chi, s1hi), s2hi), v);
+      s2lo = s1lo; s1lo = lo;
+      s2hi = s1hi; s1hi = hi;
+      e += sample * sample;
+    }
+    _mm_storeu_ps(s1, s1lo); _mm_storeu_ps(s1 + 4, s1hi);
+    _mm_storeu_ps(s2, s2lo); _mm_storeu_ps(s2 + 4, s2hi);
+    energy += e;
+#elif defined(__ARM_NEON)
+    const float32x4_t clo = vld1q_f32(dtmfcoef);
+    const float32x4_t chi = vld1q_f32(dtmfcoef + 4);
+    float32x4_t s1lo = vld1q_f32(s1), s1hi = vld1q_f32(s1 + 4);
+    float32x4_t s2lo = vld1q_f32(s2), s2hi = vld1q_f32(s2 + 4);
+    float e = 0.0f;
+    for (; i < end; i++) {
+      float sample = x[i];
+      float32x4_t v = vdupq_n_f32(sample);
+      float32x4_t lo = vaddq_f32(vmlaq_f32(vnegq_f32(s2lo), clo, s1lo), v);
+      float32x4_t hi = vaddq_f32(vmlaq_f32(vnegq_f32(s2hi), chi, s1hi), v);
+      s2lo = s1lo; s1lo = lo;
+      s2hi = s1hi; s1hi = hi;
+      e += sample * sample;
+    }
+    vst1q_f32(s1, s1lo); vst1q_f32(s1 + 4, s1hi);
+    vst1q_f32(s2, s2lo); vst1q_f32(s2 + 4, s2hi);
+    energy += e;
+#else
+    for (; i < end; i++) {
+      float sample = x[i];
+      for (unsigned k = 0; k < 8; k++) {
+        float s0 = dtmfcoef[k] * s1[k] - s2[k] + sample;
+        s2[k] = s1[k];
+        s1[k] = s0;
+      }
+      energy += sample * sample;
+    }
+#endif
+
+    if (blockpos == DTMF_BLOCK_SAMPLES)
+      EndBlock(tones);
+  }
+  return tones.size() - found;
+}
+
+void DtmfDetector::EndBlock(std::vector< Tone> &tones)
+{
+  float power[8];
+  for (unsigned k = 0; k < 8; k++) {
+    power[k] = s1[k] * s1[k] + s2[k] * s2[k] - dtmfcoef[k] * s1[k] * s2[k];
+    s1[k] = s2[k] = 0.0f;
+  }
+  char digit = Classify(power, energy);
+  energy = 0.0;
+  blockpos = 0U;
+
+  // a digit starts after two blocks agree and ends after two blocks
+  // without it, so single block glitches neither start nor end one
+  if (current) {
+    if (digit == current)
+      lastblock = blocks;
+    else if (blocks - lastblock >= 2) {
+      Tone tone = { current,
+        (unsigned)(firstblock * DTMF_BLOCK_MILLIS),
+        (unsigned)((lastblock + 1) * DTMF_BLOCK_MILLIS) };
+      tones.push_back(tone);
+      current = 0;
+    }
+  }
+  if (!current  &&  digit  &&  digit == candidate) {
+    current = digit;
+    firstblock = blocks - 1;
+    lastblock = blocks;
+  }
+  candidate = digit;
+  blocks++;
+}
+
+char DtmfDetector::Classify(const float *power, double energy)
+{
+  const double n = DTMF_BLOCK_SAMPLES;
+  const double minpower =
+    DTMF_MIN_AMPLITUDE * n / 2.0 * DTMF_MIN_AMPLITUDE * n / 2.0;
+
+  unsigned row = 0U, col = 4U;
+  for (unsigned k = 1; k < 4; k++) {
+    if (power[k] > power[row])
+      row = k;
+    if (power[k + 4] > power[col])
+      col = k + 4;
+  }
+
+  if (power[row] < minpower  ||  power[col] < minpower)
+    return 0;
+  if (power[col] > power[row] * DTMF_TWIST_NORMAL
+      ||  power[row] > power[col] * DTMF_TWIST_REVERSE)
+    return 0;
+  for (unsigned k = 0; k < 4; k++) {
+    if (k != row  &&  power[k] * DTMF_RELATIVE_PEAK > power[row])
+      return 0;
+    if (k + 4 != col  &&  power[k + 4] * DTMF_RELATIVE_PEAK > power[col])
+      return 0;
+  }
+  // speech and noise spread their energy over many frequencies
+  if (power[row] + power[col] < DTMF_MIN_TONE_RATIO * n * energy)
+    return 0;
+
+  return dtmfkeys[row][col - 4];
+}
+
+
+
+////
+// DtmfGenerator
+DtmfGenerator::Params DtmfGenerator::params;
+
+DtmfGenerator::Params::Params() :
+  duration(100U), gap(50U), mode(RFC2833)
+{
+}
+
+bool DtmfGenerator::Params::Parse(const PString &spec)
+{
+  PStringArray items = spec.Tokenise(",");
+  for (PINDEX i = 0; i < items.GetSize(); i++) {
+    PString item = items[i].Trim();
+    PINDEX eq = item.Find('=');
+    if (eq == P_MAX_INDEX) {
+      std::cerr << "dtmf: missing value for \"" << item << "\"" << std::endl;
+      return false;
+    }
+
+    PString key = item.Left(eq).Trim().ToLower();
+    PString value = item.Mid(eq + 1).Trim();
+    if (key == "duration")
+      duration = value.AsUnsigned();
+    else if (key == "gap")
+      gap = value.AsUnsigned();
+    else if (key == "mode") {
+      value = value.ToLower();
+      if (value == "rfc2833")
+        mode = RFC2833;
+      else if (value == "inband")
+        mode = INBAND;
+      else {
+        std::cerr << "dtmf: unknown mode \"" << value << "\"" << std::endl;
+        return false;
+      }
+    }
+    else {
+      std::cerr << "dtmf: unknown key \"" << key << "\"" << std::endl;
+      return false;
+    }
+  }
+
+  if (!duration) {
+    std::cerr << "dtmf: duration must be at least 1 ms" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void DtmfGenerator::Synthesise(const PString &digits, PBYTEArray &pcm,
+    unsigned rate)
+{
+  const size_t persample = rate / 1000U;      // samples per ms
+  size_t count = digits.GetLength();
+  if (!count) {
+    pcm.SetSize(0);
+    return;
+  }
+  size_t samples =
+    (count * params.duration + (count - 1) * params.gap) * persample;
+  short *out = reinterpret_cast< short *>(pcm.GetPointer(samples * 2));
+  memset(out, 0, samples * 2);
+
+  for (size_t d = 0; d < count; d++) {
+    short *tone = out + d * (params.duration + params.gap) * persample;
+    unsigned row = 4U, col = 4U;
+    for (unsigned r = 0; r < 4; r++)
+      for (unsigned c = 0; c < 4; c++)
+        if (dtmfkeys[r][c] == digits[(PINDEX)d]) {
+          row = r;
+          col = c;
+        }
+    if (row == 4U)
+      continue;
+
+    const double wr = 2.0 * M_PI * dtmffreq[row] / rate;
+    const double wc = 2.0 * M_PI * dtmffreq[col + 4] / rate;
+    for (size_t i = 0; i < params.duration * persample; i++)
+      tone[i] = (short)(DTMF_ROW_AMPLITUDE * sin(wr * i)
+          + DTMF_COL_AMPLITUDE * sin(wc * i));
+  }
+}
+
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
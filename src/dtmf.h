@@ -0,0 +1,103 @@
+/*
+ * sipcmd, dtmf.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#ifndef DTMF_H
+#define DTMF_H
+
+#include <stddef.h>
+#include <vector>
+#include "includes.h"
+
+// In-band DTMF detector for 8 kHz PCM16. Runs Goertzel filters for all
+// eight DTMF frequencies side by side over 20 ms blocks, checks level,
+// twist and tone purity per block and reports a digit once it has been
+// seen in two blocks running and has gone again.
+class DtmfDetector {
+  public:
+    // one received digit, times in ms from the start of the stream
+    struct Tone {
+      char digit;
+      unsigned start;
+      unsigned end;
+    };
+
+    DtmfDetector();
+
+    // feeds samples, appends finished digits to 'tones'
+    // -returns the number of digits appended
+    size_t Process(const short *samples, size_t count,
+        std::vector< Tone> &tones);
+
+    // reports a digit still sounding, as the stream ends, then resets
+    // -returns the number of digits appended
+    size_t Flush(std::vector< Tone> &tones);
+
+    void Reset();
+
+    // digit the Goertzel powers of one block show, 0 if none
+    static char Classify(const float *power, double energy);
+
+  private:
+    void EndBlock(std::vector< Tone> &tones);
+
+    float s1[8];
+    float s2[8];
+    double energy;
+    unsigned blockpos;
+    unsigned long blocks;
+    char candidate;
+    char current;
+    unsigned long firstblock;
+    unsigned long lastblock;
+};
+
+// DTMF transmission settings and in-band tone synthesis.
+class DtmfGenerator {
+  public:
+    enum Mode {
+      RFC2833,
+      INBAND
+    };
+
+    // set with --dtmf "duration=100,gap=50,mode=inband"
+    struct Params {
+      Params();
+      bool Parse(const PString &spec);
+
+      unsigned duration;    // ms of tone per digit
+      unsigned gap;         // ms of pause between digits
+      Mode mode;
+    };
+
+    static void SetParams(const Params &p) { params = p; }
+    static const Params &GetParams() { return params; }
+
+    // PCM16 dual tones at 'rate' for the digits, with 'gap' ms of
+    // silence between them; digits without a tone ('!') become silence
+    static void Synthesise(const PString &digits, PBYTEArray &pcm,
+        unsigned rate = 8000U);
+
+  private:
+    static Params params;
+};
+
+#endif // DTMF_H
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
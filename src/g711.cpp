@@ -0,0 +1,140 @@
+/*
+ * sipcmd, g711.cpp
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#include "g711.h"
+
+// segment ends of the 14 bit mu-law and 13 bit A-law magnitudes
+static const short ulawsegend[8] = {
+  0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF
+};
+static const short alawsegend[8] = {
+  0x1F, 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF
+};
+
+#define ULAW_BIAS				0x84
+#define ULAW_CLIP				8159
+
+static inline unsigned Segment(int value, const short *ends)
+{
+  unsigned seg = 0;
+  while (seg < 8  &&  value > ends[seg])
+    seg++;
+  return seg;
+}
+
+BYTE G711::LinearToUlaw(short sample)
+{
+  int value = sample >> 2;
+  BYTE mask = 0xFF;
+  if (value < 0) {
+    value = -value;
+    mask = 0x7F;
+  }
+  if (value > ULAW_CLIP)
+    value = ULAW_CLIP;
+  value += ULAW_BIAS >> 2;
+
+  unsigned seg = Segment(value, ulawsegend);
+  if (seg >= 8)
+    return 0x7F ^ mask;
+  return ((seg << 4) | ((value >> (seg + 1)) & 0x0F)) ^ mask;
+}
+
+BYTE G711::LinearToAlaw(short sample)
+{
+  int value = sample >> 3;
+  BYTE mask = 0xD5;
+  if (value < 0) {
+    value = -value - 1;
+    mask = 0x55;
+  }
+
+  unsigned seg = Segment(value, alawsegend);
+  if (seg >= 8)
+    return 0x7F ^ mask;
+  BYTE code = seg << 4;
+  code |= (seg < 2 ? value >> 1 : value >> seg) & 0x0F;
+  return code ^ mask;
+}
+
+short G711::UlawToLinear(BYTE code)
+{
+  code = ~code;
+  int t = ((code & 0x0F) << 3) + ULAW_BIAS;
+  t <<= (code & 0x70) >> 4;
+  return (code & 0x80) ? ULAW_BIAS - t : t - ULAW_BIAS;
+}
+
+short G711::AlawToLinear(BYTE code)
+{
+  code ^= 0x55;
+  int t = (code & 0x0F) << 4;
+  unsigned seg = (code & 0x70) >> 4;
+  if (seg == 0)
+    t += 8;
+  else {
+    t += 0x108;
+    if (seg > 1)
+      t <<= seg - 1;
+  }
+  return (code & 0x80) ? t : -t;
+}
+
+
+////
+// lookup tables, 16 kB + 8 kB to encode and 1 kB to decode
+static BYTE ulawenc[1 << 14];
+static BYTE alawenc[1 << 13];
+static short ulawdec[256];
+static short alawdec[256];
+
+static struct G711Tables {
+  G711Tables() {
+    for (int i = 0; i < (1 << 14); i++)
+      ulawenc[i] = G711::LinearToUlaw((short)((i - (1 << 13)) << 2));
+    for (int i = 0; i < (1 << 13); i++)
+      alawenc[i] = G711::LinearToAlaw((short)((i - (1 << 12)) << 3));
+    for (int i = 0; i < 256; i++) {
+      ulawdec[i] = G711::UlawToLinear((BYTE)i);
+      alawdec[i] = G711::AlawToLinear((BYTE)i);
+    }
+  }
+} g711tables;
+
+void G711::Encode(Law law, const short *pcm, size_t count, BYTE *out)
+{
+  // the encoders only look at the top 14 or 13 bits
+  if (law == ULAW)
+    for (size_t i = 0; i < count; i++)
+      out[i] = ulawenc[(pcm[i] >> 2) + (1 << 13)];
+  else
+    for (size_t i = 0; i < count; i++)
+      out[i] = alawenc[(pcm[i] >> 3) + (1 << 12)];
+}
+
+void G711::Decode(Law law, const BYTE *in, size_t count, short *pcm)
+{
+  const short *table = law == ULAW ? ulawdec : alawdec;
+  for (size_t i = 0; i < count; i++)
+    pcm[i] = table[in[i]];
+}
+
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
@@ -0,0 +1,52 @@
+/*
+ * sipcmd, g711.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#ifndef G711_H
+#define G711_H
+
+#include <stddef.h>
+#include "includes.h"
+
+// G.711 companding for -P rtp mode. Both directions are single table
+// lookups: a sample indexes the encoder table by its 14 (mu-law) or 13
+// (A-law) significant bits and a code byte the decoder table. The tables
+// are built once from the ITU reference algorithms.
+class G711 {
+  public:
+    enum Law {
+      ULAW,
+      ALAW
+    };
+
+    // 'count' PCM16 samples to as many code bytes
+    static void Encode(Law law, const short *pcm, size_t count, BYTE *out);
+    // 'count' code bytes to as many PCM16 samples
+    static void Decode(Law law, const BYTE *in, size_t count, short *pcm);
+
+    // the reference algorithms the tables are built from
+    static BYTE LinearToUlaw(short sample);
+    static BYTE LinearToAlaw(short sample);
+    static short UlawToLinear(BYTE code);
+    static short AlawToLinear(BYTE code);
+};
+
+#endif // G711_H
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
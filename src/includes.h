@@ -24,6 +24,7 @@
 #include <sip/sip.h>
 #include <h323/h323.h>
 #include <opal/localep.h>
+#include <opal/patch.h>
 
 #ifdef DEBUG
 #define debug cerr
@@ -0,0 +1,162 @@
+/*
+ * sipcmd, latency.cpp
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#include <time.h>
+#include <cstdio>
+#include <sstream>
+#include "latency.h"
+
+LatencyStats *LatencyStats::instance = NULL;
+
+static const struct {
+  const char *name;
+  CallTimeline::Event from;
+  CallTimeline::Event to;
+} intervals[LatencyStats::NumIntervals] = {
+  { "trying",    CallTimeline::INVITE,   CallTimeline::PROVISIONAL },
+  { "post-dial", CallTimeline::INVITE,   CallTimeline::RINGING },
+  { "ring",      CallTimeline::RINGING,  CallTimeline::ANSWERED },
+  { "setup",     CallTimeline::INVITE,   CallTimeline::ANSWERED },
+  { "ack",       CallTimeline::ANSWERED, CallTimeline::ACK },
+  { "media-out", CallTimeline::ANSWERED, CallTimeline::RTP_OUT },
+  { "media-in",  CallTimeline::ANSWERED, CallTimeline::RTP_IN },
+  { "teardown",  CallTimeline::BYE,      CallTimeline::RELEASED }
+};
+
+////
+// CallTimeline
+void CallTimeline::Reset()
+{
+  for (unsigned i = 0; i < NumEvents; i++)
+    stamps[i] = 0;
+}
+
+int64_t CallTimeline::Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+////
+// LatencyHistogram
+void LatencyHistogram::Reset()
+{
+  for (unsigned i = 0; i < LATENCY_BUCKETS; i++)
+    counts[i] = 0UL;
+  count = 0UL;
+  max = 0U;
+}
+
+unsigned LatencyHistogram::Bucket(uint64_t v)
+{
+  if (v < LATENCY_SUB_BUCKETS)
+    return (unsigned)v;
+  unsigned msb = 63U - __builtin_clzll(v);
+  // the four bits below the top one pick the sub-bucket
+  unsigned b = (msb - 3U) * LATENCY_SUB_BUCKETS
+    + (unsigned)((v >> (msb - 4U)) & (LATENCY_SUB_BUCKETS - 1U));
+  return b < LATENCY_BUCKETS ? b : LATENCY_BUCKETS - 1U;
+}
+
+void LatencyHistogram::Add(uint64_t usec)
+{
+  counts[Bucket(usec)]++;
+  count++;
+  if (usec > max)
+    max = usec;
+}
+
+uint64_t LatencyHistogram::Percentile(double p) const
+{
+  if (!count)
+    return 0U;
+  unsigned long rank = (unsigned long)(p * count + 0.999999);
+  if (rank < 1UL)
+    rank = 1UL;
+  unsigned long seen = 0UL;
+  for (unsigned b = 0; b < LATENCY_BUCKETS; b++) {
+    seen += counts[b];
+    if (seen < rank)
+      continue;
+    if (b < LATENCY_SUB_BUCKETS)
+      return b;
+    // middle of the bucket, never above the largest sample
+    unsigned shift = b / LATENCY_SUB_BUCKETS - 1U;
+    uint64_t low = (uint64_t)(LATENCY_SUB_BUCKETS + b % LATENCY_SUB_BUCKETS)
+      << shift;
+    uint64_t mid = low + ((1ULL << shift) >> 1);
+    return mid < max ? mid : max;
+  }
+  return max;
+}
+
+////
+// LatencyStats
+void LatencyStats::Finish(CallTimeline &timeline, unsigned callid)
+{
+  // every connection of a call is released, only the first counts
+  if (!timeline.Get(CallTimeline::INVITE)) {
+    timeline.Reset();
+    return;
+  }
+  timeline.Mark(CallTimeline::RELEASED);
+
+  std::stringstream line;
+  line << "Latency: call " << callid;
+  {
+    PWaitAndSignal lock(mutex);
+    calls++;
+    for (unsigned i = 0; i < NumIntervals; i++) {
+      int64_t from = timeline.Get(intervals[i].from);
+      int64_t to = timeline.Get(intervals[i].to);
+      if (!from  ||  !to  ||  to < from)
+        continue;
+      histograms[i].Add(to - from);
+      char buf[32];
+      snprintf(buf, sizeof(buf), " %.1f", (to - from) / 1000.0);
+      line << " " << intervals[i].name << buf << "ms";
+    }
+  }
+  std::cerr << line.str() << std::endl;
+  timeline.Reset();
+}
+
+void LatencyStats::PrintStats(ostream &os)
+{
+  PWaitAndSignal lock(mutex);
+  if (!calls)
+    return;
+  os << "latency: " << calls << " calls, ms p50/p95/p99/max" << std::endl;
+  for (unsigned i = 0; i < NumIntervals; i++) {
+    const LatencyHistogram &h = histograms[i];
+    if (!h.GetCount())
+      continue;
+    char buf[128];
+    snprintf(buf, sizeof(buf), "  %-10s n=%-8lu %.1f/%.1f/%.1f/%.1f",
+        intervals[i].name, h.GetCount(),
+        h.Percentile(0.50) / 1000.0, h.Percentile(0.95) / 1000.0,
+        h.Percentile(0.99) / 1000.0, h.GetMax() / 1000.0);
+    os << buf << std::endl;
+  }
+}
+
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
@@ -0,0 +1,133 @@
+/*
+ * sipcmd, latency.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <atomic>
+#include <stdint.h>
+#include "includes.h"
+
+// 16 sub-buckets per power of two, values up to 2^40 us
+#define LATENCY_SUB_BUCKETS			16U
+#define LATENCY_BUCKETS				(LATENCY_SUB_BUCKETS * 38U)
+
+// Monotonic timestamps (us) of the signalling and media milestones of
+// one call. Marks come from OPAL and media threads, the first mark of
+// each event wins.
+class CallTimeline {
+  public:
+    enum Event {
+      INVITE,           // INVITE sent or received, call start for rtp
+      PROVISIONAL,      // first 1xx
+      RINGING,          // first 180 or 183
+      ANSWERED,         // 200 OK
+      ACK,
+      RTP_OUT,          // first media frame sent
+      RTP_IN,           // first media frame received
+      BYE,              // BYE sent or received
+      RELEASED,
+      NumEvents
+    };
+
+    CallTimeline() { Reset(); }
+
+    void Mark(Event e) {
+      if (stamps[e].load(std::memory_order_relaxed))
+        return;
+      int64_t unset = 0;
+      stamps[e].compare_exchange_strong(unset, Now());
+    }
+    int64_t Get(Event e) const { return stamps[e]; }
+    void Reset();
+
+    static int64_t Now();
+
+  private:
+    std::atomic< int64_t> stamps[NumEvents];
+
+    CallTimeline(const CallTimeline&);
+    CallTimeline operator=(CallTimeline&);
+};
+
+// Log-linear histogram of latencies in us, within 1/16 of the value.
+class LatencyHistogram {
+  public:
+    LatencyHistogram() { Reset(); }
+
+    void Add(uint64_t usec);
+    void Reset();
+
+    // value at or below which a share 'p' of the samples lie
+    uint64_t Percentile(double p) const;
+    unsigned long GetCount() const { return count; }
+    uint64_t GetMax() const { return max; }
+
+  private:
+    static unsigned Bucket(uint64_t v);
+
+    unsigned long counts[LATENCY_BUCKETS];
+    unsigned long count;
+    uint64_t max;
+};
+
+// Process wide latency breakdown of all finished calls.
+class LatencyStats {
+  public:
+    enum Interval {
+      TRYING,           // INVITE to first 1xx
+      POSTDIAL,         // INVITE to ringing
+      RING,             // ringing to answer
+      SETUP,            // INVITE to answer
+      ACKDELAY,         // answer to ACK
+      MEDIA_OUT,        // answer to first media sent
+      MEDIA_IN,         // answer to first media received
+      TEARDOWN,         // BYE to release
+      NumIntervals
+    };
+
+    static LatencyStats &Instance() {
+      if (!instance)
+        instance = new LatencyStats();
+      return *instance;
+    }
+
+    // adds a released call and prints its breakdown, then resets the
+    // timeline for the next call of the context
+    void Finish(CallTimeline &timeline, unsigned callid);
+
+    // prints p50/p95/p99 of every interval
+    void PrintStats(ostream &os);
+
+  private:
+    static LatencyStats *instance;
+
+    PMutex mutex;
+    LatencyHistogram histograms[NumIntervals];
+    unsigned long calls;
+
+    LatencyStats() : mutex(), calls(0UL) { }
+    LatencyStats(const LatencyStats&);
+    LatencyStats operator=(LatencyStats&);
+};
+
+#endif // LATENCY_H
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
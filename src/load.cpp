@@ -0,0 +1,281 @@
+/*
+ * sipcmd, load.cpp
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <ptclib/random.h>
+#include "load.h"
+#include "commands.h"
+#include "state.h"
+
+////
+// LoadProfile
+LoadProfile::LoadProfile() :
+  cps(1.0), maxcalls(10U), rampup(0U), steady(60U), rampdown(0U),
+  jitter(0U), seed(1U), calls(0UL)
+{
+}
+
+bool LoadProfile::Parse(const PString &spec)
+{
+  PStringArray items = spec.Tokenise(",");
+  for (PINDEX i = 0; i < items.GetSize(); i++) {
+    PString item = items[i].Trim();
+    if (item.IsEmpty())
+      continue;
+
+    PINDEX eq = item.Find('=');
+    if (eq == P_MAX_INDEX) {
+      std::cerr << "load profile: missing value for \"" << item << "\""
+        << std::endl;
+      return false;
+    }
+
+    PString key = item.Left(eq).Trim().ToLower();
+    PString value = item.Mid(eq + 1).Trim();
+    if (key == "cps")
+      cps = value.AsReal();
+    else if (key == "max")
+      maxcalls = value.AsUnsigned();
+    else if (key == "rampup")
+      rampup = value.AsUnsigned();
+    else if (key == "steady")
+      steady = value.AsUnsigned();
+    else if (key == "rampdown")
+      rampdown = value.AsUnsigned();
+    else if (key == "jitter")
+      jitter = value.AsUnsigned();
+    else if (key == "seed")
+      seed = value.AsUnsigned();
+    else if (key == "calls")
+      calls = value.AsUnsigned();
+    else {
+      std::cerr << "load profile: unknown key \"" << key << "\"" << std::endl;
+      return false;
+    }
+  }
+
+  if (cps <= 0.0  ||  maxcalls == 0U  ||  jitter > 100U) {
+    std::cerr << "load profile: need cps > 0, max > 0 and jitter <= 100"
+      << std::endl;
+    return false;
+  }
+  return true;
+}
+
+double LoadProfile::TargetRate(double secs) const
+{
+  if (secs < rampup)
+    return cps * secs / rampup;
+  secs -= rampup;
+  if (secs < steady)
+    return cps;
+  secs -= steady;
+  if (secs < rampdown)
+    return cps * (1.0 - secs / rampdown);
+  return 0.0;
+}
+
+
+////
+// LoadCall, runs the program for one call
+class LoadCall : public PThread
+{
+    PCLASSINFO(LoadCall, PThread);
+
+  public:
+    LoadCall(LoadGenerator &g, Manager &m,
+        const Program &prog, unsigned s)
+      : PThread(10000, AutoDeleteThread, NormalPriority, "LoadCall"),
+      generator(g), manager(m), program(prog), slot(s) {
+        Resume();
+      }
+
+    void Main() {
+      bool ok;
+      std::string error;
+      {
+        CallContext ctx(slot);
+        manager.AttachContext(ctx);
+
+        ok = program.Run(ctx);
+        error = ctx.GetErrorString();
+
+        // programs need not hang up themselves
+        if (ctx.GetState() != TPState::CLOSED)
+          manager.Hangup(ctx);
+        manager.DetachContext(ctx);
+      }
+      generator.OnCallDone(slot, ok, error);
+    }
+
+  private:
+    LoadGenerator &generator;
+    Manager &manager;
+    const Program &program;
+    unsigned slot;
+};
+
+
+////
+// LoadGenerator
+LoadGenerator::LoadGenerator(Manager &m, const Program &prog,
+    const LoadProfile &p) :
+  manager(m), program(prog), profile(p), mutex(),
+  slots(p.maxcalls + 1, false), active(0U), started(0UL),
+  succeeded(0UL), failed(0UL), blocked(0UL), startedAtLastReport(0UL)
+{
+  // slot 0 is left to the main context
+  slots[0] = true;
+}
+
+unsigned LoadGenerator::AcquireSlot()
+{
+  PWaitAndSignal lock(mutex);
+  for (unsigned i = 1; i < slots.size(); i++) {
+    if (!slots[i]) {
+      slots[i] = true;
+      active++;
+      started++;
+      return i;
+    }
+  }
+  return 0U;
+}
+
+void LoadGenerator::OnCallDone(unsigned slot, bool ok,
+    const std::string &error)
+{
+  if (!ok)
+    std::cerr << "load: call in slot " << slot << " failed: "
+      << error << std::endl;
+
+  PWaitAndSignal lock(mutex);
+  slots[slot] = false;
+  active--;
+  if (ok)
+    succeeded++;
+  else
+    failed++;
+}
+
+void LoadGenerator::Report(double secs, double target, bool final)
+{
+  PWaitAndSignal lock(mutex);
+  double achieved = final ?
+    (secs > 0.0 ? started / secs : 0.0) :
+    started - startedAtLastReport;
+  startedAtLastReport = started;
+
+  std::cout << "load: " << (final ? "total " : "") 
+    << std::fixed << std::setprecision(1) << secs << "s"
+    << " target " << target << " cps"
+    << " achieved " << achieved << " cps"
+    << " active " << active
+    << " started " << started
+    << " ok " << succeeded
+    << " failed " << failed
+    << " blocked " << blocked << std::endl;
+}
+
+bool LoadGenerator::Run()
+{
+  std::cerr << "load: " << profile.cps << " cps, max " << profile.maxcalls
+    << " calls, profile " << profile.rampup << "/" << profile.steady
+    << "/" << profile.rampdown << " s, jitter " << profile.jitter
+    << "%, seed " << profile.seed << std::endl;
+
+  PRandom random(profile.seed);
+  const PInt64 begin = PTimer::Tick().GetMilliSeconds();
+  PInt64 nextreport = 1000;
+  double laststart = -1.0;
+  double interval = 0.0;
+  bool waiting = false;
+
+  while (!TPState::Instance().IsTerminated()) {
+    PInt64 now = PTimer::Tick().GetMilliSeconds() - begin;
+    double secs = now / 1000.0;
+
+    if (now >= nextreport) {
+      Report(nextreport / 1000.0, profile.TargetRate(secs));
+      nextreport += 1000;
+    }
+
+    if (secs >= profile.Duration()
+        ||  (profile.calls  &&  started >= profile.calls))
+      break;
+
+    double rate = profile.TargetRate(secs);
+    if (rate <= 0.0) {
+      PThread::Sleep(10);
+      continue;
+    }
+
+    // the interval follows the ramp, the jitter is drawn once per call
+    double due = laststart < 0.0 ? now : laststart + interval * 1000.0 / rate;
+    if (now < due) {
+      PInt64 sleep = (PInt64)(due - now);
+      PThread::Sleep(sleep > 10 ? 10 : (sleep < 1 ? 1 : sleep));
+      continue;
+    }
+
+    unsigned slot = AcquireSlot();
+    if (!slot) {
+      // concurrency cap reached, hold the call until a slot frees up
+      if (!waiting) {
+        PWaitAndSignal lock(mutex);
+        blocked++;
+      }
+      waiting = true;
+      PThread::Sleep(1);
+      continue;
+    }
+    waiting = false;
+
+    new LoadCall(*this, manager, program, slot);
+
+    // keep the schedule unless we fell more than a call behind
+    double next = laststart < 0.0 ? now : due;
+    laststart = now - next > 1000.0 / rate ? now : next;
+    interval = 1.0;
+    if (profile.jitter)
+      interval += ((int)(random.Generate() % (2 * profile.jitter + 1))
+          - (int)profile.jitter) / 100.0;
+  }
+
+  // let the calls in progress finish
+  std::cerr << "load: waiting for " << active << " calls to finish"
+    << std::endl;
+  for (;;) {
+    {
+      PWaitAndSignal lock(mutex);
+      if (!active)
+        break;
+    }
+    PThread::Sleep(100);
+  }
+
+  double secs = (PTimer::Tick().GetMilliSeconds() - begin) / 1000.0;
+  Report(secs, profile.cps, true);
+  return failed == 0UL;
+}
+
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
@@ -0,0 +1,91 @@
+/*
+ * sipcmd, load.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#ifndef LOAD_H
+#define LOAD_H
+
+#include <vector>
+#include "includes.h"
+
+class Program;
+class Manager;
+
+// load profile, parsed from
+// --load "cps=10,max=50,rampup=30,steady=300,rampdown=30,jitter=20,seed=1"
+// durations are in seconds, jitter in percent of the call interval.
+// calls=N stops after N calls regardless of the profile.
+class LoadProfile {
+  public:
+    LoadProfile();
+
+    bool Parse(const PString &spec);
+
+    // target calls per second 'secs' seconds into the run
+    double TargetRate(double secs) const;
+    double Duration() const { return rampup + steady + rampdown; }
+
+    double cps;
+    unsigned maxcalls;
+    unsigned rampup;
+    unsigned steady;
+    unsigned rampdown;
+    unsigned jitter;
+    unsigned seed;
+    unsigned long calls;
+};
+
+// Runs the parsed -x program as a template, starting new calls at the
+// profile's rate on their own threads and call contexts. The command
+// program is shared by all calls and compiled only once.
+class LoadGenerator {
+  public:
+    LoadGenerator(Manager &m, const Program &prog,
+        const LoadProfile &p);
+
+    // runs the whole profile, returns false if any call failed
+    bool Run();
+
+    // called from the call threads
+    void OnCallDone(unsigned slot, bool ok, const std::string &error);
+
+  private:
+    unsigned AcquireSlot();
+    void Report(double secs, double target, bool final = false);
+
+    Manager &manager;
+    const Program &program;
+    LoadProfile profile;
+
+    PMutex mutex;
+    std::vector< bool> slots;
+    unsigned active;
+    unsigned long started;
+    unsigned long succeeded;
+    unsigned long failed;
+    unsigned long blocked;
+    unsigned long startedAtLastReport;
+
+    LoadGenerator(const LoadGenerator&);
+    LoadGenerator operator=(LoadGenerator&);
+};
+
+#endif // LOAD_H
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
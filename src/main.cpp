@@ -21,16 +21,30 @@
 #include <iostream>
 #include <sstream>
 #include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
 #include "main.h"
 #include "commands.h"
 #include "state.h"
+#include "load.h"
+#include "audiocache.h"
+#include "pcap.h"
+#include "dtmf.h"
+#include "latency.h"
+#include "standin.h"
+#include "ttscache.h"
 
 //#include "channels.h"
 int DIAL_TIMEOUT;
 
 TPState *TPState::instance = NULL;
 
+// the benchmark links everything but brings its own process
+#ifndef SIPCMD_BENCH
 PCREATE_PROCESS(TestProcess);
+#endif
 
 static std::string stringify(const PString &broken) {
     std::stringstream s;
@@ -54,7 +68,51 @@ static void print_help() {
         << "-g <addr>    --gatekeeper <addr>      gatekeeper to use" << endl 
         << "-w <addr>    --gateway <addr>         gateway to use" << endl 
         << "-a <name>    --alias <name>           username alias" << endl 
-        << "-m <codec>   --mediaformat <codec>    select codec" << endl << endl;
+        << "-m <codec>   --mediaformat <codec>    select codec" << endl
+        << "             --vad <params>           voice activity detector tuning,"
+        << endl
+        << "    <params> := key=value[,key=value...] with keys onset, release"
+        << endl
+        << "    (dB over noise floor), minlevel (dBFS), maxzcr and hangover (ms)"
+        << endl
+        << "             --dtmf <params>          DTMF transmission,"
+        << endl
+        << "    <params> := key=value[,key=value...] with keys duration, gap"
+        << endl
+        << "    (ms, default 100 and 50) and mode (rfc2833 or inband)"
+        << endl
+        << "             --pcap <file>            capture RTP and SIP to a pcap file"
+        << endl
+        << "    (RTP both ways, SIP as received; sent RTP of SIP and H.323" << endl
+        << "    calls carries no sequence number or SSRC yet)" << endl
+        << "             --stand-in <profile>     play the far end on 127.0.0.1,"
+        << endl
+        << "    serving every incoming call with the program" << endl
+        << "    <profile> := key=value[,key=value...] with keys" << endl
+        << "    answer (delay in ms), echo (0/1), max (concurrent calls)" << endl
+        << "    and calls (stop after this many calls)" << endl
+        << "             --prompt-cache <kB>      memory cap of the prompt cache"
+        << endl
+        << "             --stream-prebuffer <ms>  audio gathered before a streamed"
+        << endl
+        << "    prompt (v- or vfifo:<path>) starts, default 200" << endl
+        << "             --record-encoded         record G.711 calls as received,"
+        << endl
+        << "    8 bit mu-law or A-law, without decoding" << endl
+        << "             --tts <profile>          cache of rendered text prompts"
+        << endl
+        << "    (vtts:<text>), <profile> := key=value[,key=value...]" << endl
+        << "    with keys voice, dir (default /tmp/sipcmd-tts) and max" << endl
+        << "    (MB on disk, default 64)" << endl
+        << "             --tts-cmd <command>      renders text on a cache miss,"
+        << endl
+        << "    %t text, %v voice, %o output WAV file, %r session rate" << endl
+        << "             --load <profile>         run the program as a load test"
+        << endl
+        << "    <profile> := key=value[,key=value...] with keys" << endl
+        << "    cps (calls per second), max (concurrent calls)," << endl
+        << "    rampup, steady, rampdown (seconds), jitter (percent)," << endl
+        << "    seed and calls (stop after this many calls)" << endl << endl;
 
     cerr << "The EBNF definition of the program syntax:" << endl
         << "<prog>  := cmd ';' <prog> | " << endl
@@ -65,9 +123,11 @@ static void print_help() {
         << "answer  := 'a' [ expectedremoteparty ]" << endl
         << "hangup  := 'h'" << endl
         << "dtmf    := 'd' digits" << endl
-        << "voice   := 'v' audiofile" << endl
-        << "record  := 'r' [ append ] [ silence ] [ iter ] millis audiofile" 
-        << endl
+        << "voice   := 'v' ( audiofile | source )" << endl
+        << "source  := '-' | 'fifo:' fifopath | 'tts:' text" << endl
+        << "record  := 'r' [ append ] [ silence ] [ iter ] millis"
+        << " ( audiofile | stream )" << endl
+        << "stream  := '-' | 'unix:' socketpath | fifopath" << endl
         << "append  := 'a'" << endl
         << "silence := 's'" << endl
         << "closed  := 'c'" << endl
@@ -154,24 +214,81 @@ std::string get_call_end_reason_string(OpalConnection::CallEndReason r) {
     return "Unknown";
 }
 
+// the handler only sets the flag and writes the signal to this pipe;
+// ending the calls takes locks, SignalWatcher does that
+static int signalpipe[2] = { -1, -1 };
+
 void signalHandler(int sig) {
-    std::cerr << "signal caught!" << std::endl;
+    static const char msg[] = "signal caught!\n";
+    ssize_t n = write(STDERR_FILENO, msg, sizeof(msg) - 1);
     switch (sig) {
         case SIGTERM:
-        case SIGINT:
-            TPState::Instance().SetState(TPState::TERMINATED);
+        case SIGINT: {
+            TPState::Instance().SetTerminated();
+            char c = (char)sig;
+            n = write(signalpipe[1], &c, 1);
+        }
         default:
             break;
     }
+    (void)n;
 }
 
-void initSignalHandling() {
+////
+// SignalWatcher, ends every call once a signal has arrived
+class SignalWatcher : public PThread
+{
+    PCLASSINFO(SignalWatcher, PThread);
+
+  public:
+    SignalWatcher()
+      : PThread(10000, NoAutoDeleteThread, NormalPriority, "SignalWatcher") {
+        Resume();
+    }
+
+    void Main() {
+        // returns when the write end is closed at exit
+        char c;
+        ssize_t n;
+        while ((n = read(signalpipe[0], &c, 1)) != 0) {
+            if (n < 0  &&  errno != EINTR)
+                break;
+            if (n > 0  &&  TPState::Instance().GetManager())
+                TPState::Instance().GetManager()->TerminateAll();
+        }
+    }
+};
+
+SignalWatcher *initSignalHandling() {
+    if (pipe(signalpipe) != 0) {
+        std::cerr << "cannot create the signal pipe: " << strerror(errno)
+            << std::endl;
+        return NULL;
+    }
+    // never block in the handler, and keep the pipe from --tts-cmd
+    fcntl(signalpipe[1], F_SETFL, O_NONBLOCK);
+    fcntl(signalpipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(signalpipe[1], F_SETFD, FD_CLOEXEC);
+    SignalWatcher *watcher = new SignalWatcher();
+
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
     sa.sa_flags = SA_RESTART;
     sa.sa_handler = signalHandler;
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
+    return watcher;
+}
+
+void finishSignalHandling(SignalWatcher *watcher) {
+    if (!watcher)
+        return;
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    close(signalpipe[1]);
+    watcher->WaitForTermination();
+    delete watcher;
+    close(signalpipe[0]);
 }
 
 TestProcess::TestProcess() :
@@ -185,12 +302,18 @@ void TestProcess::Main()
 //  debug << "in debug mode" << std::endl;
     PArgList &args = GetArguments();
 
-    initSignalHandling();
+    SignalWatcher *watcher = initSignalHandling();
     manager = new Manager();
-    if (manager->Init(args))
+    if (manager->Init(args)) {
         manager->Main(args);
+        AudioCache::Instance().PrintStats(std::cout);
+        TtsCache::Instance().PrintStats(std::cout);
+        LatencyStats::Instance().PrintStats(std::cout);
+    }
 
     std::cout << "Exiting." << std::endl;
+    // no TerminateAll once the manager is gone
+    finishSignalHandling(watcher);
     delete manager;
 
 }
@@ -206,6 +329,11 @@ PSafePtr<OpalConnection> LocalEndPoint::MakeConnection(OpalCall &call,
         OpalConnection::StringOptions *opts)
 {
     std::cerr << "LocalEndpoint::" << __func__ << std::endl;
+    // outgoing calls pass their context as user data, bind it before
+    // any of the manager callbacks for this call can run
+    if (userData)
+        m_manager.BindContext(
+                *static_cast<CallContext *>(userData), call.GetToken());
     return AddConnection(CreateConnection(call, userData, options, opts));
 // return OpalLocalEndPoint::MakeConnection(call, remoteParty, userData, options, opts);
 }
@@ -219,6 +347,17 @@ OpalLocalConnection * LocalEndPoint::CreateConnection(
     return new LocalConnection(call, *this, userData, opts, stropts);
 }
 
+OpalMediaFormatList LocalEndPoint::GetMediaFormats() const
+{
+    OpalMediaFormatList formats = OpalLocalEndPoint::GetMediaFormats();
+    // offered natively, G.711 reaches the channels without a transcoder
+    if (TestChanAudio::IsRecordEncoded()) {
+        formats += OpalG711_ULAW_64K;
+        formats += OpalG711_ALAW_64K;
+    }
+    return formats;
+}
+
 // callback to hande data to be sent.
 bool LocalEndPoint::OnReadMediaData(
     const OpalLocalConnection &connection,
@@ -244,7 +383,7 @@ bool LocalEndPoint::OnWriteMediaData(
   //        (BYTE*)data, length, written);
 }
 
-Manager::Manager() : localep(NULL), sipep(NULL), h323ep(NULL), listenmode(false), listenerup(false), pauseBeforeDialing(false), mediaFilter("*")
+Manager::Manager() : localep(NULL), sipep(NULL), h323ep(NULL), pcap(NULL), standin(NULL), listenerup(false), pauseBeforeDialing(false), mediaFilter("*")
 {
   std::cerr << __func__  << std::endl;
 }
@@ -253,7 +392,8 @@ Manager::Manager() : localep(NULL), sipep(NULL), h323ep(NULL), listenmode(false)
 Manager:: ~Manager()
 {
   std::cerr << __func__ << std::endl;
-  delete (m_rtpsession);
+  delete standin;
+  delete pcap;
 }
 
 
@@ -275,7 +415,7 @@ void Manager::Main(PArgList &args)
 
     // init command sequence
     const char *cmdseq = "";
-    std::vector<Command*> sequence;
+    Program program;
     
     if (args.HasOption('T')) {
                
@@ -287,6 +427,9 @@ void Manager::Main(PArgList &args)
         
         cmdseq = args.GetOptionString('x');
     }
+    else if (standin) {
+        cmdseq = STANDIN_DEFAULT_PROGRAM;
+    }
 
     if (args.HasOption('m')) {
          
@@ -295,29 +438,55 @@ void Manager::Main(PArgList &args)
     }
  
     // Parse command sequence
-    if(!Command::Parse(cmdseq, sequence)) {
+    if(!program.Compile(cmdseq)) {
 
         cerr << "Problem parsing command string \""
             << args.GetOptionString('x') << "\":" << endl
             << "  " << Command::GetErrorString() << endl;
+        return;
+    }
 
-        Command::DeleteSequence(sequence);
+    if (args.HasOption("load")) {
+        LoadProfile profile;
+        if (!profile.Parse(args.GetOptionString("load"))) {
+            cerr << "Problem parsing load profile \""
+                << args.GetOptionString("load") << "\"" << endl;
+        }
+        else {
+            LoadGenerator generator(*this, program, profile);
+            generator.Run();
+        }
+
+        std::cerr << "TestPhone::Main: shutting down" << endl;
+        ClearAllCalls();
+        std::cerr << "TestPhone::Main: exiting..." << endl;
+        return;
+    }
+
+    if (standin) {
+        standin->Run(program);
+
+        std::cerr << "TestPhone::Main: shutting down" << endl;
+        ClearAllCalls();
+        std::cerr << "TestPhone::Main: exiting..." << endl;
         return;
     }
 
+    CallContext ctx;
+    AttachContext(ctx);
+
     // run it
-    else if(!Command::Run(sequence)) {
+    if(!program.Run(ctx)) {
 
         cerr << "Problem running command sequence (\""
             << args.GetOptionString('x') << "\"):" << endl
-            << "  " << Command::GetErrorString() << endl;
-
-        Command::DeleteSequence(sequence);
+            << "  " << ctx.GetErrorString() << endl;
     }
 
     std::cerr << "TestPhone::Main: shutting down" << endl;
-    TPState::Instance().SetState(TPState::TERMINATED);
+    ctx.SetState(TPState::TERMINATED);
     ClearAllCalls();
+    DetachContext(ctx);
     std::cerr << "TestPhone::Main: exiting..." << endl;
 }
 
@@ -341,6 +510,16 @@ bool Manager::Init(PArgList &args)
             "h-help:"
             "a-alias:"
             "m-mediaformat:"
+            "-load:"
+            "-prompt-cache:"
+            "-pcap:"
+            "-record-encoded."
+            "-stream-prebuffer:"
+            "-tts:"
+            "-tts-cmd:"
+            "-vad:"
+            "-dtmf:"
+            "-stand-in:"
             );
 
 
@@ -367,10 +546,66 @@ bool Manager::Init(PArgList &args)
         TPState::Instance().SetLocalAddress(args.GetOptionString('l'));
     }
 
+    if (args.HasOption("vad")) {
+        VoiceActivityDetector::Params vadparams;
+        if (!vadparams.Parse(args.GetOptionString("vad")))
+            return false;
+        VoiceActivityDetector::SetDefaultParams(vadparams);
+    }
+
+    if (args.HasOption("dtmf")) {
+        DtmfGenerator::Params dtmfparams;
+        if (!dtmfparams.Parse(args.GetOptionString("dtmf")))
+            return false;
+        DtmfGenerator::SetParams(dtmfparams);
+    }
+
+    if (args.HasOption("pcap")) {
+        pcap = PcapWriter::Create(args.GetOptionString("pcap"));
+        if (!pcap)
+            return false;
+    }
+
+    if (args.HasOption("stream-prebuffer"))
+        PlaybackStream::SetPrebufferMillis(
+                args.GetOptionString("stream-prebuffer").AsUnsigned());
+
+    if (args.HasOption("record-encoded"))
+        TestChanAudio::SetRecordEncoded(true);
+
+    if (args.HasOption("prompt-cache")) {
+        AudioCache::Instance().SetMaxBytes(
+                args.GetOptionString("prompt-cache").AsUnsigned() * 1024U);
+    }
+
+    if (args.HasOption("tts")) {
+        TtsProfile ttsprofile;
+        if (!ttsprofile.Parse(args.GetOptionString("tts")))
+            return false;
+        TtsCache::Instance().SetProfile(ttsprofile);
+    }
+
+    if (args.HasOption("tts-cmd"))
+        TtsCache::Instance().SetCommand(args.GetOptionString("tts-cmd"));
+
     string protocol = stringify(args.GetOptionString('P')); 
+    if (args.HasOption("stand-in")) {
+        StandInProfile standinprofile;
+        if (!standinprofile.Parse(args.GetOptionString("stand-in")))
+            return false;
+        if (protocol.compare("sip")) {
+            std::cerr << "the stand-in needs -P sip" << std::endl;
+            return false;
+        }
+        // offline unless told otherwise
+        if (!args.HasOption('l'))
+            TPState::Instance().SetLocalAddress("127.0.0.1");
+        standin = new StandIn(*this, standinprofile);
+    }
+
     if (!protocol.compare("sip")) {
         std::cerr << "initialising SIP endpoint..." << endl;
-        sipep = new SIPEndPoint(*this);
+        sipep = new TestSIPEndPoint(*this);
 
         sipep->SetRetryTimeouts(10000, 30000);
         sipep->SetSendUserInputMode(OpalConnection::SendUserInputAsRFC2833);
@@ -414,6 +649,10 @@ bool Manager::Init(PArgList &args)
             }
         }
 
+        // the stand-in takes REGISTERs before any Answer runs
+        if (standin  &&  !IsListenerUp()  &&  !StartListener())
+            return false;
+
         TPState::Instance().SetProtocol(TPState::SIP);
 
     } else if (!protocol.compare("h323")) {
@@ -442,6 +681,8 @@ bool Manager::Init(PArgList &args)
     }
 
     SetAudioJitterDelay(20, 1000);
+    // in-band digits are picked up by our own detector on the media
+    // path, see dtmf.h
     DisableDetectInBandDTMF(true);
 
     localep = new LocalEndPoint(*this);
@@ -450,34 +691,62 @@ bool Manager::Init(PArgList &args)
     return true;
 }
 
-bool Manager::SendDTMF(const PString &dtmf)
+bool Manager::SendDTMF(CallContext &ctx, const PString &dtmf)
 {
-    PSafePtr<OpalCall> call = FindCallWithLock(currentCallToken);
+    const DtmfGenerator::Params &p = DtmfGenerator::GetParams();
+
+    // plain RTP has no signalling for events, tones go in the audio
+    if (p.mode == DtmfGenerator::INBAND ||
+            TPState::Instance().GetProtocol() == TPState::RTP) {
+        PBYTEArray tones;
+        DtmfGenerator::Synthesise(dtmf, tones,
+                ctx.GetPlayBackAudio().GetFormat().GetSampleRate());
+        std::cout << "sent DTMF: [" << dtmf << "] in-band" << std::endl;
+        // returns when the last sample has been played out
+        bool ok = ctx.GetPlayBackAudio().PlaybackAudioBuffer(tones);
+        if (!ok)
+            std::cerr << "dtmf sending failed\n" << std::endl;
+        return ok;
+    }
+
+    PSafePtr<OpalCall> call = FindCallWithLock(ctx.GetToken());
     if (!call) {
         std::cerr << "no call found with token="
-            << currentCallToken << std::endl;
+            << ctx.GetToken() << std::endl;
         return false;
     }
 
     bool ok = false;
     PSafePtr<OpalConnection> connection = call->GetConnection(
-            listenmode ? 0 : 1);
+            ctx.IsIncoming() ? 0 : 1);
     if (connection) {
-        int i = 0;
-        for (; i < dtmf.GetSize() - 1; i++) {
-            if (!connection->SendUserInputTone(dtmf[i], 0))
+        // each digit is sent as an RFC 2833 event of the configured
+        // duration, the next one when that and the gap are over. The
+        // schedule is absolute so that slow sends do not add up, and we
+        // return when the last event has ended.
+        struct timespec next;
+        clock_gettime(CLOCK_MONOTONIC, &next);
+        PINDEX i = 0;
+        for (; i < dtmf.GetLength(); i++) {
+            if (i)
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+            if (ctx.GetState() == TPState::TERMINATED ||
+                    !connection->SendUserInputTone(dtmf[i], p.duration))
                 break;
-            else {
-                // sleep a while
-                std::cout << "sent DTMF: [" << dtmf[i] << "]"  << std::endl;
-
-                struct timespec tp;
-                tp.tv_sec = 0;
-                tp.tv_nsec = 500 * 1000 * 1000; // half a second
-                nanosleep (&tp, 0);
+            std::cout << "sent DTMF: [" << dtmf[i] << "]"  << std::endl;
+
+            unsigned millis = p.duration +
+                (i + 1 < dtmf.GetLength() ? p.gap : 0U);
+            next.tv_sec += millis / 1000;
+            next.tv_nsec += (long)(millis % 1000) * 1000000L;
+            if (next.tv_nsec >= 1000000000L) {
+                next.tv_sec++;
+                next.tv_nsec -= 1000000000L;
             }
         }
-        ok = (i == dtmf.GetSize() - 1 ? true : false);
+        ok = (i == dtmf.GetLength());
+        if (ok)
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
     }
 
     if (!ok)
@@ -486,16 +755,127 @@ bool Manager::SendDTMF(const PString &dtmf)
     return ok;
 }
             
-RTPSession::RTPSession(const Params& options) : RTP_UDP(options), m_audioformat(NULL)
+TestSIPEndPoint::TestSIPEndPoint(Manager &m) :
+  SIPEndPoint(m), m_manager(m)
+{
+}
+
+PBoolean TestSIPEndPoint::OnReceivedPDU(OpalTransport &transport,
+    SIP_PDU *pdu)
+{
+  PcapWriter *pcap = m_manager.GetPcapWriter();
+  if (pcap  &&  pdu) {
+    PIPSocket::Address local, remote;
+    WORD localport = 0, remoteport = 0;
+    transport.GetLocalAddress().GetIpAndPort(local, localport);
+    transport.GetRemoteAddress().GetIpAndPort(remote, remoteport);
+
+    std::string text = pdu->Build();
+    pcap->AddUDP(remote, remoteport, local, localport,
+        reinterpret_cast< const BYTE *>(text.data()), text.size());
+  }
+
+  StandIn *standin = m_manager.GetStandIn();
+  if (standin  &&  pdu  &&  pdu->GetMethod() == SIP_PDU::Method_REGISTER)
+    return standin->OnReceivedREGISTER(transport, *this, *pdu);
+  return SIPEndPoint::OnReceivedPDU(transport, pdu);
+}
+
+SIPConnection *TestSIPEndPoint::CreateConnection(OpalCall &call,
+    const PString &token, void *userData, const SIPURL &destination,
+    OpalTransport *transport, SIP_PDU *invite, unsigned int options,
+    OpalConnection::StringOptions *stringOptions)
+{
+  return new TestSIPConnection(call, *this, token, destination,
+      transport, options, stringOptions);
+}
+
+TestSIPConnection::TestSIPConnection(OpalCall &call, TestSIPEndPoint &ep,
+    const PString &token, const SIPURL &destination,
+    OpalTransport *transport, unsigned int options,
+    OpalConnection::StringOptions *stringOptions) :
+  SIPConnection(call, ep, token, destination, transport, options,
+      stringOptions),
+  m_manager(ep.GetManager())
+{
+}
+
+void TestSIPConnection::Mark(int event)
+{
+  // incoming calls are bound to a context only after the INVITE
+  CallContext *ctx = m_manager.FindContext(GetCall().GetToken());
+  if (ctx)
+    ctx->GetTimeline().Mark((CallTimeline::Event)event);
+}
+
+PBoolean TestSIPConnection::SetUpConnection()
+{
+  Mark(CallTimeline::INVITE);
+  return SIPConnection::SetUpConnection();
+}
+
+void TestSIPConnection::OnReceivedResponse(SIPTransaction &transaction,
+    SIP_PDU &response)
+{
+  unsigned code = response.GetStatusCode();
+  if (transaction.GetMethod() == SIP_PDU::Method_INVITE) {
+    if (code >= 100  &&  code < 200)
+      Mark(CallTimeline::PROVISIONAL);
+    if (code == 180  ||  code == 183)
+      Mark(CallTimeline::RINGING);
+    if (code >= 200  &&  code < 300)
+      Mark(CallTimeline::ANSWERED);
+  }
+  SIPConnection::OnReceivedResponse(transaction, response);
+  // the ACK for a final response goes out from the handler above
+  if (transaction.GetMethod() == SIP_PDU::Method_INVITE
+      &&  code >= 200  &&  code < 300)
+    Mark(CallTimeline::ACK);
+}
+
+void TestSIPConnection::OnReceivedACK(SIP_PDU &pdu)
+{
+  Mark(CallTimeline::ACK);
+  SIPConnection::OnReceivedACK(pdu);
+}
+
+void TestSIPConnection::OnReceivedBYE(SIP_PDU &pdu)
+{
+  Mark(CallTimeline::BYE);
+  SIPConnection::OnReceivedBYE(pdu);
+}
+
+void TestSIPConnection::OnReleased()
+{
+  // sends our BYE unless the remote one came first
+  Mark(CallTimeline::BYE);
+  SIPConnection::OnReleased();
+}
+
+RTPSession::RTPSession(const Params& options, CallContext &ctx) :
+  RTP_UDP(options), m_context(ctx), m_audioformat(NULL), m_payload(PCM16)
 {
   std::cerr << "RTP session created" << std::endl;
 }
 
+RTPSession::~RTPSession()
+{
+  RtpStats stats;
+  stats.FromSession(*this);
+  stats.FromReceiver(m_rxstats);
+  stats.PrintJSON(std::cout, m_context.GetId(), GetSessionID());
+  m_context.GetRecordAudio().FlushDTMF();
+  delete m_audioformat;
+}
+
 void RTPSession::SelectAudioFormat(const Payload payload) 
 {
   if (m_audioformat) 
     delete m_audioformat;
 
+  // frame size is bytes per frame time: 8 samples are 16 bytes of PCM16
+  // and 8 bytes of G.711
+  m_payload = payload;
   switch(payload) {
     case PCM16:
       m_audioformat = new OpalAudioFormat(
@@ -504,28 +884,62 @@ void RTPSession::SelectAudioFormat(const Payload payload)
       break;
     case G711_ULAW:
       m_audioformat = new OpalAudioFormat(
-          "OPAL_G711_ULAW_64K", RTP_DataFrame::PCMU, "PCMU", 16, 8, 240, 0, 256, 8000, 0);
+          "OPAL_G711_ULAW_64K", RTP_DataFrame::PCMU, "PCMU", 8, 8, 240, 0, 256, 8000, 0);
       std::cerr << "Payload format: OPAL_G711_ULAW_64K" << endl;
       break;
     case G711_ALAW:
       m_audioformat = new OpalAudioFormat(
-          "OPAL_G711_ALAW_64K", RTP_DataFrame::PCMA, "PCMA", 16, 8, 240, 0, 256, 8000, 0);
-      std::cerr << "Payload format: OPAL_G711_ULAW_64K" << endl;
+          "OPAL_G711_ALAW_64K", RTP_DataFrame::PCMA, "PCMA", 8, 8, 240, 0, 256, 8000, 0);
+      std::cerr << "Payload format: OPAL_G711_ALAW_64K" << endl;
       break;
   }
+
+  // the channels time the audio by the payload's clock
+  AudioProperties props(m_audioformat->GetClockRate(), RTP_FRAME_MILLIS);
+  if (payload == G711_ULAW)
+    props.SetEncoding(AudioProperties::G711_ULAW);
+  else if (payload == G711_ALAW)
+    props.SetEncoding(AudioProperties::G711_ALAW);
+  m_context.GetPlayBackAudio().SetFormat(props);
+  m_context.GetRecordAudio().SetFormat(props);
+}
+
+RTP_DataFrame::PayloadTypes RTPSession::GetPayloadType() const
+{
+  int pt = m_audioformat ? m_audioformat->GetPayloadType()
+    : RTP_DataFrame::MaxPayloadType;
+  if (pt >= RTP_DataFrame::MaxPayloadType)
+    return RTP_DataFrame::DynamicBase;
+  return (RTP_DataFrame::PayloadTypes)pt;
+}
+
+RTPSession::Payload RTPSession::PayloadFromFilter(const PString &filter)
+{
+  // matches OPAL's names (G.711-ALaw-64k) as well as the SDP ones (PCMA)
+  PCaselessString f = filter;
+  if (f.Find("alaw") != P_MAX_INDEX  ||  f.Find("pcma") != P_MAX_INDEX)
+    return G711_ALAW;
+  if (f.Find("ulaw") != P_MAX_INDEX  ||  f.Find("pcmu") != P_MAX_INDEX
+      ||  f.Find("711") != P_MAX_INDEX)
+    return G711_ULAW;
+  return PCM16;
 }
 
 RTP_Session::SendReceiveStatus RTPSession::OnReceiveData(RTP_DataFrame &frame) 
 {
   SendReceiveStatus ret =  RTP_UDP::Internal_OnReceiveData(frame);
-#if 1 // master dump
+  m_rxstats.Update(frame.GetSequenceNumber(), frame.GetTimestamp(),
+      CallTimeline::Now(), GetAudioFormat().GetClockRate());
+#ifdef DEBUG // master dump
   std::ostringstream os;
   frame.PrintOn(os);
   std::cerr << os.str() << std::endl;
 #endif
+  Capture(frame, false);
 
-  TPState::Instance().GetRecordAudio().RecordFromBuffer(
-      (const char*)frame.GetPayloadPtr(), frame.GetPayloadSize(), true);
+  // G.711 is decoded by the channel, which knows the payload from its format
+  m_context.GetRecordAudio().ReceiveFrame(
+      (const char*)frame.GetPayloadPtr(), frame.GetPayloadSize());
   return ret;
 }
 
@@ -533,29 +947,47 @@ RTP_Session::SendReceiveStatus RTPSession::OnSendData(RTP_DataFrame &frame)
 {
   SendReceiveStatus ret = RTP_UDP::Internal_OnSendData(frame);
 
-#if 1 // master dump
+#ifdef DEBUG // master dump
   std::ostringstream os;
   frame.PrintOn(os);
   std::cerr << os.str() << std::endl;
 #endif
+  Capture(frame, true);
 
   return ret;
 }
 
 
+void RTPSession::Capture(RTP_DataFrame &frame, bool sent)
+{
+  PcapWriter *pcap = TPState::Instance().GetManager()->GetPcapWriter();
+  if (!pcap)
+    return;
+
+  const BYTE *packet = frame.GetPointer();
+  size_t len = frame.GetHeaderSize() + frame.GetPayloadSize();
+  if (sent)
+    pcap->AddUDP(GetLocalAddress(), GetLocalDataPort(),
+        GetRemoteAddress(), GetRemoteDataPort(), packet, len);
+  else
+    pcap->AddUDP(GetRemoteAddress(), GetRemoteDataPort(),
+        GetLocalAddress(), GetLocalDataPort(), packet, len);
+}
+
 RTP_Session::SendReceiveStatus RTPSession::OnReadTimeout(RTP_DataFrame &frame) {
   std::cerr << __func__ << std::endl;
-  TPState::Instance().GetRecordAudio().StopRecording(false);
+  m_context.GetRecordAudio().StopRecording(false);
   return RTP_UDP::OnReadTimeout(frame);
 }
 
 
-bool Manager::MakeCall(const PString &remoteParty)
+bool Manager::MakeCall(CallContext &ctx, const PString &remoteParty)
 {
     std::cerr << "Setting up a call to: " << remoteParty << endl;
     PString token;
+    ctx.SetIncoming(false);
     if (TPState::Instance().GetProtocol() != TPState::RTP) {
-      if (!SetUpCall("local:*", remoteParty, token)) {
+      if (!SetUpCall("local:*", remoteParty, token, &ctx)) {
         cerr << "Call setup to " << remoteParty << " failed" << endl;
         return false;
       }
@@ -574,47 +1006,220 @@ bool Manager::MakeCall(const PString &remoteParty)
       p.userData = new RTPUserData;
 
       //m_rtpsession->SetUserData(new RTPUserData);
-      m_rtpsession = new RTPSession(p);
-      m_rtpsession->SelectAudioFormat(RTPSession::PCM16);
+      RTPSession *rtpsession = new RTPSession(p, ctx);
+      rtpsession->SelectAudioFormat(
+          RTPSession::PayloadFromFilter(mediaFilter));
+      delete ctx.GetRTPSession();
+      ctx.SetRTPSession(rtpsession);
 
-      // local and remote addresses
+      // local and remote addresses, every call gets its own port pair
       PIPSocket::Address remote(arr[0]);
       PIPSocket::Address local(TPState::Instance().GetLocalAddress());
+      WORD port = TPState::Instance().GetListenPort() + 2 * ctx.GetId();
       
-      if (!m_rtpsession->SetRemoteSocketInfo(remote, arr[1].AsInteger(), true)) {
+      if (!rtpsession->SetRemoteSocketInfo(remote, arr[1].AsInteger(), true)) {
         cerr << "could not set remote socket info" << endl;
         return false;
       }
 
-      if (!m_rtpsession->Open(local,
-            TPState::Instance().GetListenPort(), 
-            TPState::Instance().GetListenPort(), 2)) {
+      if (!rtpsession->Open(local, port, port, 2)) {
         cerr << "could not open rtp session" << endl;
         return false;
       }
 
-      m_rtpsession->SetJitterBufferSize(100, 1000);
+      rtpsession->SetJitterBufferSize(100, 1000);
       std::cerr  
          << "RTP local address:     " << local << std::endl
-         << "RTP local data port:   " << m_rtpsession->GetLocalDataPort() << std::endl
+         << "RTP local data port:   " << rtpsession->GetLocalDataPort() << std::endl
          << "RTP remote address:    " << remote << std::endl
-         << "RTP remote data port:  " << m_rtpsession->GetRemoteDataPort() << std::endl;
+         << "RTP remote data port:  " << rtpsession->GetRemoteDataPort() << std::endl;
      
       std::cerr << "RTP stream set up!" << std::endl;
-      TPState::Instance().SetState(TPState::ESTABLISHED);
+      // no signalling, the call starts answered
+      ctx.GetTimeline().Mark(CallTimeline::INVITE);
+      ctx.GetTimeline().Mark(CallTimeline::ANSWERED);
+      ctx.SetState(TPState::ESTABLISHED);
       return true;
     }
 
     std::cerr << "connection set up to " << remoteParty << endl;
-    std::string val = token;
-    currentCallToken = val;
+    BindContext(ctx, token);
     return true;
 }
 
-unsigned Manager::CalculateTimestamp(const size_t size) 
+bool Manager::Hangup(CallContext &ctx)
+{
+    if (TPState::Instance().GetProtocol() == TPState::RTP) {
+      delete ctx.GetRTPSession();
+      ctx.SetRTPSession(NULL);
+      ctx.GetTimeline().Mark(CallTimeline::BYE);
+      LatencyStats::Instance().Finish(ctx.GetTimeline(), ctx.GetId());
+      ctx.SetState(TPState::CLOSED);
+      return true;
+    }
+
+    if (ctx.GetToken().IsEmpty())
+      return true;
+
+    return ClearCallSynchronous(ctx.GetToken());
+}
+
+void Manager::AttachContext(CallContext &ctx)
+{
+    PWaitAndSignal lock(contextsMutex);
+    contexts.push_back(&ctx);
+}
+
+void Manager::DetachContext(CallContext &ctx)
+{
+    PWaitAndSignal lock(contextsMutex);
+    contexts.remove(&ctx);
+
+    std::map<std::string, CallContext *>::iterator it = callContexts.begin();
+    while (it != callContexts.end()) {
+        if (it->second == &ctx)
+            callContexts.erase(it++);
+        else
+            ++it;
+    }
+}
+
+void Manager::BindContext(CallContext &ctx, const PString &token)
+{
+    PWaitAndSignal lock(contextsMutex);
+    ctx.SetToken(token);
+    callContexts[stringify(token)] = &ctx;
+}
+
+CallContext *Manager::FindContext(const PString &token)
+{
+    PWaitAndSignal lock(contextsMutex);
+    std::map<std::string, CallContext *>::iterator it =
+        callContexts.find(stringify(token));
+    return it == callContexts.end() ? NULL : it->second;
+}
+
+void Manager::TerminateAll()
+{
+    PWaitAndSignal lock(contextsMutex);
+    std::list<CallContext *>::iterator it = contexts.begin();
+    for (; it != contexts.end(); ++it)
+        (*it)->SetState(TPState::TERMINATED);
+}
+
+////
+// CallContext
+//
+
+static PInt64 MonotonicMillis()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (PInt64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+CallContext::CallContext(unsigned callid)
+    : state(TPState::Instance().IsTerminated() ?
+          TPState::TERMINATED : TPState::STARTING),
+      generation(0), events(0), waiters(0),
+      activity(0), silence(0),
+      id(callid), token(), incoming(false), listening(false), echo(false),
+      rtpsession(NULL), errorstring(), timeline(),
+      playbackaudio(*this), recordaudio(*this)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    // deadlines are taken from the monotonic clock so that wall clock
+    // steps do not stretch or cut waits
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&stateCond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&stateMutex, NULL);
+    for (unsigned i = 0; i < 5; i++)
+        transitions[i] = 0;
+    transitions[StateIndex(state)] = MonotonicMillis();
+}
+
+CallContext::~CallContext()
+{
+    delete rtpsession;
+    if (TPState::Instance().GetManager())
+        TPState::Instance().GetManager()->DetachContext(*this);
+    pthread_cond_destroy(&stateCond);
+    pthread_mutex_destroy(&stateMutex);
+}
+
+void CallContext::SetState(TPState::TPConnState newstate)
+{
+    pthread_mutex_lock(&stateMutex);
+    if (state != TPState::TERMINATED && state != newstate) {
+        transitions[StateIndex(newstate)] = MonotonicMillis();
+        state = newstate;
+        generation++;
+    }
+    pthread_mutex_unlock(&stateMutex);
+    NotifyEvent();
+}
+
+void CallContext::NotifyEvent()
+{
+    events++;
+    // media threads may call this from any frame; only take the lock
+    // when somebody is actually waiting
+    if (waiters > 0) {
+        pthread_mutex_lock(&stateMutex);
+        pthread_cond_broadcast(&stateCond);
+        pthread_mutex_unlock(&stateMutex);
+    }
+}
+
+void CallContext::WaitForEvent(unsigned long seen, unsigned millis)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += millis / 1000;
+    deadline.tv_nsec += (long)(millis % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&stateMutex);
+    waiters++;
+    while (events == seen) {
+        if (pthread_cond_timedwait(&stateCond, &stateMutex, &deadline)
+                == ETIMEDOUT)
+            break;
+    }
+    waiters--;
+    pthread_mutex_unlock(&stateMutex);
+}
+
+TPState::TPConnState CallContext::WaitForStateChange(
+        TPState::TPConnState breakonstate, unsigned millis)
 {
-  unsigned frametime = m_rtpsession->GetAudioFormat().GetFrameTime();
-  unsigned framesize = m_rtpsession->GetAudioFormat().GetFrameSize();
+    PInt64 deadline = MonotonicMillis() + millis;
+    unsigned long gen = generation;
+    for (;;) {
+        // read the event count first so that a transition after the
+        // checks below ends the wait at once
+        unsigned long seen = events;
+        TPState::TPConnState st = state;
+        if (st == TPState::TERMINATED || st == breakonstate ||
+                generation != gen)
+            return st;
+        PInt64 left = deadline - MonotonicMillis();
+        if (left <= 0)
+            return st;
+        WaitForEvent(seen, (unsigned)left);
+    }
+}
+
+unsigned Manager::CalculateTimestamp(CallContext &ctx, const size_t size) 
+{
+  RTPSession *rtpsession = ctx.GetRTPSession();
+  unsigned frametime = rtpsession->GetAudioFormat().GetFrameTime();
+  unsigned framesize = rtpsession->GetAudioFormat().GetFrameSize();
   if (framesize == 0) 
     return frametime;
 
@@ -622,20 +1227,26 @@ unsigned Manager::CalculateTimestamp(const size_t size)
   return frames * frametime;
 }
 
-bool Manager::WriteFrame(RTP_DataFrame &frame) 
+bool Manager::WriteFrame(CallContext &ctx, RTP_DataFrame &frame) 
 {
-  return m_rtpsession && m_rtpsession->Internal_WriteData(frame);
+  RTPSession *rtpsession = ctx.GetRTPSession();
+  ctx.GetTimeline().Mark(CallTimeline::RTP_OUT);
+  return rtpsession && rtpsession->Internal_WriteData(frame);
 }
 
-bool Manager::ReadFrame(RTP_DataFrame &frame)
+bool Manager::ReadFrame(CallContext &ctx, RTP_DataFrame &frame)
 {
-  return m_rtpsession && m_rtpsession->ReadBufferedData(frame);
+  RTPSession *rtpsession = ctx.GetRTPSession();
+  return rtpsession && rtpsession->ReadBufferedData(frame);
 }
 
 bool Manager::StartListener()
 {
     // TODO h323.
     PIPSocket::Address sipaddr = INADDR_ANY;
+    // the stand-in keeps to its own address, 127.0.0.1 by default
+    if (standin)
+        sipaddr = PIPSocket::Address(TPState::Instance().GetLocalAddress());
     std::cerr << "Listening for SIP signalling on " << sipaddr << ":" 
          << TPState::Instance().GetListenPort() << endl;
   
@@ -674,9 +1285,74 @@ bool Manager::OnOpenMediaStream(OpalConnection &connection,
     return true;
 }
 
-void RTPUserData::OnTxStatistics(const RTP_Session &session)
+void Manager::OnStartMediaPatch(OpalConnection &connection,
+        OpalMediaPatch &patch)
 {
-  std::cerr << __func__ << endl;
+    OpalManager::OnStartMediaPatch(connection, patch);
+    if (!pcap)
+        return;
+
+    // the filter runs at the RTP side's format: on frames as received
+    // when that is the source, once encoded for sending when the sink
+    OpalMediaStream &source = patch.GetSource();
+    OpalMediaStreamPtr sink = patch.GetSink();
+    if (dynamic_cast<OpalRTPMediaStream *>(&source))
+        patch.AddFilter(PCREATE_NOTIFIER(OnCaptureFrame),
+                source.GetMediaFormat());
+    else if (sink != NULL  &&  dynamic_cast<OpalRTPMediaStream *>(&*sink))
+        patch.AddFilter(PCREATE_NOTIFIER(OnCaptureFrame),
+                sink->GetMediaFormat());
+}
+
+void Manager::OnCaptureFrame(RTP_DataFrame &frame, INT param)
+{
+    OpalMediaPatch *patch = reinterpret_cast<OpalMediaPatch *>(param);
+    OpalRTPMediaStream *rtpstream =
+        dynamic_cast<OpalRTPMediaStream *>(&patch->GetSource());
+    bool sent = rtpstream == NULL;
+    if (sent) {
+        OpalMediaStreamPtr sink = patch->GetSink();
+        if (sink != NULL)
+            rtpstream = dynamic_cast<OpalRTPMediaStream *>(&*sink);
+    }
+    if (!pcap  ||  !rtpstream)
+        return;
+    RTP_UDP *udp = dynamic_cast<RTP_UDP *>(&rtpstream->GetRtpSession());
+    if (!udp)
+        return;
+
+    // sent frames get their sequence number and SSRC from the session
+    // after this, the rest of the header and the payload are final
+    const BYTE *packet = frame.GetPointer();
+    size_t len = frame.GetHeaderSize() + frame.GetPayloadSize();
+    if (sent)
+        pcap->AddUDP(udp->GetLocalAddress(), udp->GetLocalDataPort(),
+                udp->GetRemoteAddress(), udp->GetRemoteDataPort(),
+                packet, len);
+    else
+        pcap->AddUDP(udp->GetRemoteAddress(), udp->GetRemoteDataPort(),
+                udp->GetLocalAddress(), udp->GetLocalDataPort(),
+                packet, len);
+}
+
+void RTPUserData::OnTxStatistics(const RTP_Session &session) const
+{
+  std::cerr << "RTP tx: session " << session.GetSessionID()
+    << " sent " << session.GetPacketsSent()
+    << " lost by remote " << session.GetPacketsLostByRemote()
+    << " jitter on remote " << session.GetJitterTimeOnRemote() << "ms"
+    << std::endl;
+}
+
+void RTPUserData::OnRxStatistics(const RTP_Session &session) const
+{
+  std::cerr << "RTP rx: session " << session.GetSessionID()
+    << " received " << session.GetPacketsReceived()
+    << " lost " << session.GetPacketsLost()
+    << " out of order " << session.GetPacketsOutOfOrder()
+    << " late " << session.GetPacketsTooLate()
+    << " jitter " << session.GetAvgJitterTime() << "ms"
+    << std::endl;
 }
 
 
@@ -685,14 +1361,31 @@ OpalConnection::AnswerCallResponse Manager::OnAnswerCall(
         const PString &caller)
 {
     std::cerr << "Incoming call from " << caller << std::endl;
-    std::string val = connection.GetCall().GetToken();
-    currentCallToken = val; 
+
+    // the stand-in lets the caller hear ringing first
+    if (standin  &&  standin->GetProfile().answer) {
+        standin->AnswerLater(connection.GetCall().GetToken());
+        return OpalConnection::AnswerCallPending;
+    }
     return OpalConnection::AnswerCallNow;
 }
 
 void Manager::OnClosedMediaStream (const OpalMediaStream &stream)
 {
     std::cerr << __func__ << std::endl;
+
+    // one report per RTP session, when its receiving stream closes
+    const OpalRTPMediaStream *rtpstream =
+        dynamic_cast<const OpalRTPMediaStream *>(&stream);
+    if (rtpstream && stream.IsSource()) {
+        CallContext *ctx =
+            FindContext(stream.GetConnection().GetCall().GetToken());
+        RtpStats stats;
+        stats.FromSession(rtpstream->GetRtpSession());
+        stats.PrintJSON(std::cout, ctx ? ctx->GetId() : 0U,
+                stream.GetSessionID());
+    }
+    OpalManager::OnClosedMediaStream(stream);
 }
 
 void Manager::AdjustMediaFormats(
@@ -710,15 +1403,59 @@ bool Manager::OnIncomingConnection(OpalConnection &connection, unsigned opts,
 {
     std::cerr << __func__ << ": token=" << connection.GetToken() << std::endl;
 
-    TPState::Instance().SetState(TPState::ESTABLISHED);
+    // bind the call to a context waiting in Answer, unless it already
+    // has one (outgoing calls, or the local half of an incoming one)
+    PString calltoken = connection.GetCall().GetToken();
+    CallContext *ctx = FindContext(calltoken);
+    if (!ctx) {
+        PWaitAndSignal lock(contextsMutex);
+        std::list<CallContext *>::iterator it = contexts.begin();
+        for (; it != contexts.end(); ++it) {
+            if ((*it)->IsListening()) {
+                ctx = *it;
+                ctx->SetListening(false);
+                ctx->SetIncoming(true);
+                ctx->SetToken(calltoken);
+                ctx->GetTimeline().Mark(CallTimeline::INVITE);
+                callContexts[stringify(calltoken)] = ctx;
+                break;
+            }
+        }
+    }
+
+    if (!ctx) {
+        std::cerr << __func__ << ": nobody is answering, refusing call"
+            << std::endl;
+        return false;
+    }
+
+    ctx->SetState(TPState::ESTABLISHED);
     //localep->AcceptIncomingCall(connection.GetCall().GetToken());
     return OpalManager::OnIncomingConnection(connection, opts, stropts);
 }
 
+void Manager::OnAlerting(OpalConnection &connection)
+{
+    CallContext *ctx = FindContext(connection.GetCall().GetToken());
+    if (ctx)
+        ctx->GetTimeline().Mark(CallTimeline::RINGING);
+    OpalManager::OnAlerting(connection);
+}
+
+void Manager::OnConnected(OpalConnection &connection)
+{
+    CallContext *ctx = FindContext(connection.GetCall().GetToken());
+    if (ctx)
+        ctx->GetTimeline().Mark(CallTimeline::ANSWERED);
+    OpalManager::OnConnected(connection);
+}
+
 void Manager::OnEstablished(OpalConnection &connection)
 {
     std::cerr << __func__ << std::endl;
-    TPState::Instance().SetState(TPState::ESTABLISHED);
+    CallContext *ctx = FindContext(connection.GetCall().GetToken());
+    if (ctx)
+        ctx->SetState(TPState::ESTABLISHED);
     OpalManager::OnEstablished(connection);
 }
 
@@ -727,12 +1464,12 @@ void Manager::OnEstablishedCall(OpalCall &call)
 {
     std::cerr << __func__ << std::endl;
 
-    TPState::Instance().SetState(TPState::ESTABLISHED);
-    currentCallToken = std::string(
-            static_cast<const char*>(call.GetToken()));
+    CallContext *ctx = FindContext(call.GetToken());
+    if (ctx)
+        ctx->SetState(TPState::ESTABLISHED);
 
     std::cerr << "In call with " << call.GetPartyB() << " using "
-        << call.GetPartyA() << " token=[" << currentCallToken << "]" 
+        << call.GetPartyA() << " token=[" << call.GetToken() << "]" 
         << std::endl;
     OpalManager::OnEstablishedCall(call);
 }
@@ -743,7 +1480,11 @@ void Manager::OnReleased(OpalConnection &connection)
     std::cerr << __func__ <<": reason: " << 
         get_call_end_reason_string(r) << std::endl;
 
-    TPState::Instance().SetState(TPState::CLOSED);
+    CallContext *ctx = FindContext(connection.GetCall().GetToken());
+    if (ctx) {
+        LatencyStats::Instance().Finish(ctx->GetTimeline(), ctx->GetId());
+        ctx->SetState(TPState::CLOSED);
+    }
     OpalManager::OnReleased(connection);
 }
 
@@ -751,6 +1492,8 @@ void Manager::OnReleased(OpalConnection &connection)
 void Manager::OnClearedCall(OpalCall &call)
 {
     std::cerr << __func__ << std::endl;
+    PWaitAndSignal lock(contextsMutex);
+    callContexts.erase(stringify(call.GetToken()));
 }
 
 void Manager::OnUserInputTone(OpalConnection &connection,char tone ,int duration)
@@ -21,9 +21,15 @@
 #ifndef CS_MANAGER_H
 #define CS_MANAGER_H
 
+#include <map>
+#include <list>
 #include "includes.h"
+#include "rtpstats.h"
 
 class Manager;
+class CallContext;
+class PcapWriter;
+class StandIn;
 
 class LocalEndPoint : public OpalLocalEndPoint {
 
@@ -47,7 +53,10 @@ class LocalEndPoint : public OpalLocalEndPoint {
                 void * userData,
                 unsigned options,
                 OpalConnection::StringOptions *strOptions);
-        
+
+        // raw PCM, and G.711 when recording it encoded
+        virtual OpalMediaFormatList GetMediaFormats() const;
+
 
         // get media data for transmission
         virtual bool OnReadMediaData(
@@ -67,12 +76,69 @@ class LocalEndPoint : public OpalLocalEndPoint {
                 PINDEX &written	 
                 ); 	
 
+        Manager &GetManager() const { return m_manager; }
+
     private:
             Manager & m_manager;
             std::string gatekeeper;
 };
 
 
+// SIP endpoint that hands received signalling to the packet capture
+class TestSIPEndPoint : public SIPEndPoint {
+  PCLASSINFO(TestSIPEndPoint, SIPEndPoint);
+
+  public:
+    TestSIPEndPoint(Manager &m);
+
+    virtual PBoolean OnReceivedPDU(
+        OpalTransport &transport,
+        SIP_PDU *pdu);
+
+    virtual SIPConnection *CreateConnection(
+        OpalCall &call,
+        const PString &token,
+        void *userData,
+        const SIPURL &destination,
+        OpalTransport *transport,
+        SIP_PDU *invite,
+        unsigned int options = 0,
+        OpalConnection::StringOptions *stringOptions = NULL);
+
+    Manager &GetManager() const { return m_manager; }
+
+  private:
+    Manager &m_manager;
+};
+
+// SIP connection that stamps the signalling milestones of its call
+class TestSIPConnection : public SIPConnection {
+  PCLASSINFO(TestSIPConnection, SIPConnection);
+
+  public:
+    TestSIPConnection(
+        OpalCall &call,
+        TestSIPEndPoint &ep,
+        const PString &token,
+        const SIPURL &destination,
+        OpalTransport *transport,
+        unsigned int options,
+        OpalConnection::StringOptions *stringOptions);
+
+    virtual PBoolean SetUpConnection();
+    virtual void OnReceivedResponse(
+        SIPTransaction &transaction,
+        SIP_PDU &response);
+    virtual void OnReceivedACK(SIP_PDU &pdu);
+    virtual void OnReceivedBYE(SIP_PDU &pdu);
+    virtual void OnReleased();
+
+  private:
+    void Mark(int event);
+
+    Manager &m_manager;
+};
+
 class RTPSession : public RTP_UDP {
   PCLASSINFO(RTPSession, RTP_UDP);
 
@@ -83,7 +149,8 @@ class RTPSession : public RTP_UDP {
       G711_ALAW
     };
 
-    RTPSession(const Params& options);
+    RTPSession(const Params& options, CallContext &ctx);
+    ~RTPSession();
 
     virtual SendReceiveStatus OnReceiveData(
         RTP_DataFrame &frame);
@@ -96,17 +163,29 @@ class RTPSession : public RTP_UDP {
 
     void SelectAudioFormat(const Payload p);
     OpalAudioFormat &GetAudioFormat() const { return *m_audioformat; }
+    Payload GetPayload() const { return m_payload; }
+    // payload type of the sent frames, dynamic for PCM16
+    RTP_DataFrame::PayloadTypes GetPayloadType() const;
+
+    // the -m codec filter's choice of payload
+    static Payload PayloadFromFilter(const PString &filter);
 
   private:
+    void Capture(RTP_DataFrame &frame, bool sent);
+
+    CallContext &m_context;
     OpalAudioFormat *m_audioformat;
-    // xxx
+    Payload m_payload;
+    RtpReceiveStats m_rxstats;
 };
 
+// periodic statistics callbacks of an RTP session
 class RTPUserData : public RTP_UserData {
   public:
     RTPUserData() : RTP_UserData() {}
 
-    virtual void OnTxStatistics(const RTP_Session &session);
+    virtual void OnTxStatistics(const RTP_Session &session) const;
+    virtual void OnRxStatistics(const RTP_Session &session) const;
 };
 
 class Manager : public OpalManager
@@ -120,12 +199,19 @@ class Manager : public OpalManager
         bool Init(PArgList &args);
         void Main(PArgList &args);
         bool StartListener();
-        bool MakeCall(const PString &remoteParty);
-        bool SendDTMF(const PString &dtmf);
-        void SetListenMode(const bool m) {
-            listenmode = m; 
-        }
+        bool MakeCall(CallContext &ctx, const PString &remoteParty);
+        bool Hangup(CallContext &ctx);
+        bool SendDTMF(CallContext &ctx, const PString &dtmf);
         bool IsListenerUp() { return listenerup; }
+        PcapWriter *GetPcapWriter() { return pcap; }
+        StandIn *GetStandIn() { return standin; }
+
+        // Call context management
+        void AttachContext(CallContext &ctx);
+        void DetachContext(CallContext &ctx);
+        void BindContext(CallContext &ctx, const PString &token);
+        CallContext *FindContext(const PString &token);
+        void TerminateAll();
 
         // Media streams management
         virtual bool OnOpenMediaStream(
@@ -135,6 +221,12 @@ class Manager : public OpalManager
         virtual void OnClosedMediaStream (
                 const OpalMediaStream &stream);
 
+        // SIP and H.323 calls: adds the pcap filter to patches that
+        // read from or write to an RTP stream
+        virtual void OnStartMediaPatch(
+                OpalConnection &connection,
+                OpalMediaPatch &patch);
+
         
         virtual void AdjustMediaFormats(
           bool local,                         ///<  Media formats a local ones to be presented to remote
@@ -148,6 +240,12 @@ class Manager : public OpalManager
                 unsigned opts,
                 OpalConnection::StringOptions *stropts);
 
+        virtual void OnAlerting(
+                OpalConnection &connection);
+
+        virtual void OnConnected(
+                OpalConnection &connection);
+
         virtual void OnEstablished(
                 OpalConnection &connection);
                 
@@ -170,21 +268,27 @@ class Manager : public OpalManager
                 char tone,
                 int duration);
 
-        bool WriteFrame(RTP_DataFrame &f);
-        bool ReadFrame(RTP_DataFrame &f);
+        bool WriteFrame(CallContext &ctx, RTP_DataFrame &f);
+        bool ReadFrame(CallContext &ctx, RTP_DataFrame &f);
 
-        unsigned CalculateTimestamp(size_t sz);
+        unsigned CalculateTimestamp(CallContext &ctx, size_t sz);
     private:
+        // patch filter, captures a frame of the patch it is called for
+        PDECLARE_NOTIFIER(RTP_DataFrame, Manager, OnCaptureFrame);
 
         LocalEndPoint *localep;
         SIPEndPoint *sipep;
         H323EndPoint *h323ep;
-        RTPSession *m_rtpsession;
+        PcapWriter *pcap;
+        StandIn *standin;
+
+        // all live call contexts, and the ones bound to a call token
+        PMutex contextsMutex;
+        std::list<CallContext *> contexts;
+        std::map<std::string, CallContext *> callContexts;
 
-        std::string currentCallToken;
         std::string inputfile;
         std::string outputfile;
-        bool listenmode;
         bool listenerup;
         bool pauseBeforeDialing;
         std::string mediaFilter;
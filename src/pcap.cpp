@@ -0,0 +1,185 @@
+/*
+ * sipcmd, pcap.cpp
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#include <sys/time.h>
+#include "pcap.h"
+
+// libpcap file format
+#define PCAP_MAGIC				0xa1b2c3d4U
+#define PCAP_LINKTYPE_RAW			101U
+#define PCAP_SNAPLEN				65535U
+#define IPV4_HEADER_LEN				20U
+#define UDP_HEADER_LEN				8U
+
+// pcap headers are in host order, the made up IP/UDP headers in network
+static inline void PutHost32(std::vector< BYTE> &v, DWORD x) {
+  const BYTE *p = reinterpret_cast< const BYTE *>(&x);
+  v.insert(v.end(), p, p + 4);
+}
+
+static inline void PutHost16(std::vector< BYTE> &v, WORD x) {
+  const BYTE *p = reinterpret_cast< const BYTE *>(&x);
+  v.insert(v.end(), p, p + 2);
+}
+
+static inline void PutNet16(BYTE *p, unsigned x) {
+  p[0] = (BYTE)(x >> 8);
+  p[1] = (BYTE)x;
+}
+
+PcapWriter::PcapWriter(PFile *f)
+  : PThread(10000, NoAutoDeleteThread, LowPriority, "PcapWriter"),
+  file(f), mutex(), pending(), writing(), stopping(false), wakeup(),
+  ipid(0), packets(0UL), dropped(0UL)
+{
+  Resume();
+}
+
+PcapWriter *PcapWriter::Create(const PString &filename)
+{
+  PFile *f = new PFile(filename, PFile::WriteOnly,
+      PFile::Create | PFile::Truncate);
+  if (!f->IsOpen()) {
+    std::cerr << "PcapWriter::" << __func__ << ": cannot create \""
+      << filename << "\"" << endl;
+    delete f;
+    return NULL;
+  }
+
+  std::vector< BYTE> header;
+  PutHost32(header, PCAP_MAGIC);
+  PutHost16(header, 2);       // version 2.4
+  PutHost16(header, 4);
+  PutHost32(header, 0);       // GMT offset
+  PutHost32(header, 0);       // timestamp accuracy
+  PutHost32(header, PCAP_SNAPLEN);
+  PutHost32(header, PCAP_LINKTYPE_RAW);
+  if (!f->Write(&header[0], header.size())) {
+    std::cerr << "PcapWriter::" << __func__ << ": cannot write \""
+      << filename << "\"" << endl;
+    delete f;
+    return NULL;
+  }
+
+  std::cerr << "capturing packets to \"" << filename << "\"" << endl;
+  return new PcapWriter(f);
+}
+
+PcapWriter::~PcapWriter()
+{
+  Close();
+}
+
+void PcapWriter::AddUDP(const PIPSocket::Address &src, WORD srcport,
+    const PIPSocket::Address &dst, WORD dstport,
+    const BYTE *data, size_t len)
+{
+  size_t iplen = IPV4_HEADER_LEN + UDP_HEADER_LEN + len;
+  if (iplen > PCAP_SNAPLEN)
+    return;
+
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+
+  PWaitAndSignal lock(mutex);
+  if (pending.size() + 16 + iplen > PCAP_MAX_PENDING_BYTES) {
+    dropped++;
+    return;
+  }
+
+  // record header
+  PutHost32(pending, tv.tv_sec);
+  PutHost32(pending, tv.tv_usec);
+  PutHost32(pending, iplen);
+  PutHost32(pending, iplen);
+
+  // IPv4 header
+  size_t at = pending.size();
+  pending.resize(at + IPV4_HEADER_LEN + UDP_HEADER_LEN);
+  BYTE *ip = &pending[at];
+  DWORD saddr = src;
+  DWORD daddr = dst;
+  ip[0] = 0x45;                       // v4, 5 words
+  ip[1] = 0;
+  PutNet16(ip + 2, iplen);
+  PutNet16(ip + 4, ipid++);
+  PutNet16(ip + 6, 0x4000);           // don't fragment
+  ip[8] = 64;                         // ttl
+  ip[9] = 17;                         // UDP
+  PutNet16(ip + 10, 0);
+  memcpy(ip + 12, &saddr, 4);         // already in network order
+  memcpy(ip + 16, &daddr, 4);
+  unsigned sum = 0;
+  for (unsigned i = 0; i < IPV4_HEADER_LEN; i += 2)
+    sum += (ip[i] << 8) | ip[i + 1];
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  PutNet16(ip + 10, ~sum & 0xffff);
+
+  // UDP header, checksum is optional over IPv4
+  BYTE *udp = ip + IPV4_HEADER_LEN;
+  PutNet16(udp, srcport);
+  PutNet16(udp + 2, dstport);
+  PutNet16(udp + 4, UDP_HEADER_LEN + len);
+  PutNet16(udp + 6, 0);
+
+  pending.insert(pending.end(), data, data + len);
+  packets++;
+}
+
+void PcapWriter::Flush()
+{
+  {
+    PWaitAndSignal lock(mutex);
+    writing.swap(pending);
+  }
+  if (!writing.empty()  &&  file
+      &&  !file->Write(&writing[0], writing.size()))
+    std::cerr << "PcapWriter::" << __func__ << ": I/O error" << endl;
+  writing.clear();
+}
+
+void PcapWriter::Main()
+{
+  while (!stopping) {
+    wakeup.Wait(PCAP_FLUSH_INTERVAL_MS);
+    Flush();
+  }
+  Flush();
+}
+
+void PcapWriter::Close()
+{
+  if (!file)
+    return;
+
+  stopping = true;
+  wakeup.Signal();
+  WaitForTermination();
+
+  std::cerr << "PcapWriter: captured " << packets << " packets, dropped "
+    << dropped << endl;
+  file->Close();
+  delete file;
+  file = NULL;
+}
+
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
@@ -0,0 +1,72 @@
+/*
+ * sipcmd, pcap.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#ifndef PCAP_H
+#define PCAP_H
+
+#include <vector>
+#include "includes.h"
+
+// packets queued beyond this are dropped rather than waited for
+#define PCAP_MAX_PENDING_BYTES			(4U << 20)
+// the writer flushes the queue at least this often
+#define PCAP_FLUSH_INTERVAL_MS			250
+
+// Writes captured UDP datagrams (RTP, SIP) as a libpcap file with raw
+// IPv4 link type. Callers only append to an in-memory queue, the file is
+// written on the capture thread.
+class PcapWriter : public PThread
+{
+    PCLASSINFO(PcapWriter, PThread);
+
+  public:
+    // creates the file and starts the capture thread
+    // -returns NULL if the file cannot be created
+    static PcapWriter *Create(const PString &filename);
+    ~PcapWriter();
+
+    // any thread: queues one datagram with an IPv4/UDP header made up
+    // from the given addresses
+    void AddUDP(const PIPSocket::Address &src, WORD srcport,
+        const PIPSocket::Address &dst, WORD dstport,
+        const BYTE *data, size_t len);
+
+    // flushes the queue and closes the file
+    void Close();
+
+  private:
+    PcapWriter(PFile *f);
+    void Main();
+    void Flush();
+
+    PFile *file;
+    PMutex mutex;
+    std::vector< BYTE> pending;
+    std::vector< BYTE> writing;
+    volatile bool stopping;
+    PSyncPoint wakeup;
+    WORD ipid;
+    unsigned long packets;
+    unsigned long dropped;
+};
+
+#endif // PCAP_H
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
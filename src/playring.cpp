@@ -0,0 +1,73 @@
+/*
+ * sipcmd, playring.cpp
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+#include <cassert>
+#include "playring.h"
+
+PlaybackRing::PlaybackRing(size_t capacity)
+  : ring(capacity), mask(capacity - 1), head(0U), tail(0U), discard(0U)
+{
+  assert((capacity & mask) == 0);
+}
+
+size_t PlaybackRing::Write(const void *buf, size_t len)
+{
+  size_t h = head.load(std::memory_order_relaxed);
+  size_t room = ring.size() - (h - tail.load(std::memory_order_acquire));
+  if (len > room)
+    len = room;
+  if (!len)
+    return 0U;
+
+  const char *src = static_cast< const char *>(buf);
+  size_t pos = h & mask;
+  size_t first = ring.size() - pos < len ? ring.size() - pos : len;
+  memcpy(&ring[pos], src, first);
+  memcpy(&ring[0], src + first, len - first);
+  head.store(h + len, std::memory_order_release);
+  return len;
+}
+
+void PlaybackRing::Discard()
+{
+  discard.store(head.load(std::memory_order_acquire),
+      std::memory_order_release);
+}
+
+size_t PlaybackRing::Read(void *buf, size_t len)
+{
+  size_t t = tail.load(std::memory_order_relaxed);
+  size_t d = discard.load(std::memory_order_acquire);
+  if (d > t)
+    t = d;
+  size_t avail = head.load(std::memory_order_acquire) - t;
+  if (len > avail)
+    len = avail;
+
+  char *dst = static_cast< char *>(buf);
+  size_t pos = t & mask;
+  size_t first = ring.size() - pos < len ? ring.size() - pos : len;
+  memcpy(dst, &ring[pos], first);
+  memcpy(dst + first, &ring[0], len - first);
+  tail.store(t + len, std::memory_order_release);
+  return len;
+}
+
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
@@ -0,0 +1,74 @@
+/*
+ * sipcmd, playring.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#ifndef PLAYRING_H
+#define PLAYRING_H
+
+#include <atomic>
+#include <vector>
+#include "includes.h"
+
+// ring size, power of two: 16 kB is 1 s of 8 kHz PCM16
+#define PLAYBACK_RING_BYTES			(1U << 14)
+// the script thread tops the ring up at least this often
+#define PLAYBACK_FEED_INTERVAL_MS		20
+
+// Carries audio to the media thread in a single producer/single consumer
+// ring. The producer writes ahead, the media thread only reads and never
+// waits. Positions are running byte counts, so the producer knows its
+// audio has been played once the read position passes the write position
+// its last byte went in at.
+class PlaybackRing
+{
+  public:
+    PlaybackRing(size_t capacity = PLAYBACK_RING_BYTES);
+
+    // producer: queues as much of buf as fits
+    // -returns the number of bytes queued
+    size_t Write(const void *buf, size_t len);
+
+    // any thread: the consumer skips everything queued so far
+    void Discard();
+
+    // consumer: dequeues up to len bytes
+    // -returns the number of bytes read
+    size_t Read(void *buf, size_t len);
+
+    size_t GetWritePosition() const {
+      return head.load(std::memory_order_acquire);
+    }
+    size_t GetReadPosition() const {
+      return tail.load(std::memory_order_acquire);
+    }
+
+  private:
+    std::vector< char> ring;
+    const size_t mask;
+    std::atomic< size_t> head;      // producer position
+    std::atomic< size_t> tail;      // consumer position
+    std::atomic< size_t> discard;   // consumer skips up to here
+
+    PlaybackRing(const PlaybackRing&);
+    PlaybackRing operator=(PlaybackRing&);
+};
+
+#endif // PLAYRING_H
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
@@ -0,0 +1,179 @@
+/*
+ * sipcmd, playstream.cpp
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include "playstream.h"
+
+// what one read takes from the source at most
+#define PLAYBACK_STREAM_READ_BYTES		4096U
+
+unsigned PlaybackStream::prebufferms = PLAYBACK_STREAM_PREBUFFER_MS;
+
+static inline unsigned GetLE16(const BYTE *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static inline unsigned GetLE32(const BYTE *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+PlaybackStream::PlaybackStream(int f, bool owned, unsigned r)
+  : fd(f), ownsfd(owned), rate(r), pending(), start(0U),
+  checkedheader(false), wavheader(false), eof(false), failed(false)
+{
+  pending.reserve(PLAYBACK_STREAM_MAX_PENDING);
+}
+
+PlaybackStream::~PlaybackStream()
+{
+  if (ownsfd)
+    close(fd);
+}
+
+bool PlaybackStream::IsStreamSource(const PString &name)
+{
+  return name == "-"  ||  name.Left(5) == "fifo:";
+}
+
+PlaybackStream *PlaybackStream::Open(const PString &name, unsigned rate)
+{
+  if (name == "-")
+    return new PlaybackStream(STDIN_FILENO, false, rate);
+
+  // non-blocking, so the voice command does not hang before the writer
+  // opens its end; poll then waits for the first audio
+  std::string path = name.Mid(5);
+  int f = open(path.c_str(), O_RDONLY | O_NONBLOCK);
+  if (f < 0) {
+    std::cerr << "PlaybackStream::" << __func__ << ": cannot open \""
+      << path << "\": " << strerror(errno) << std::endl;
+    return NULL;
+  }
+  return new PlaybackStream(f, true, rate);
+}
+
+bool PlaybackStream::Fill(unsigned millis, size_t max)
+{
+  if (eof)
+    return false;
+
+  // played bytes are dropped from the front before the buffer grows
+  if (start  &&  (start == pending.size()  ||  start >= max / 2)) {
+    pending.erase(pending.begin(), pending.begin() + start);
+    start = 0U;
+  }
+  size_t room = pending.size() - start < max ?
+    max - (pending.size() - start) : 0U;
+  if (!room) {
+    PThread::Sleep(millis);
+    return true;
+  }
+
+  struct pollfd p;
+  p.fd = fd;
+  p.events = POLLIN;
+  p.revents = 0;
+  int ready = poll(&p, 1, millis);
+  if (ready < 0  &&  errno != EINTR) {
+    failed = eof = true;
+    return false;
+  }
+  if (ready <= 0)
+    return true;
+
+  size_t old = pending.size();
+  size_t want = room < PLAYBACK_STREAM_READ_BYTES ? room :
+    PLAYBACK_STREAM_READ_BYTES;
+  pending.resize(old + want);
+  ssize_t n = read(fd, &pending[old], want);
+  pending.resize(old + (n > 0 ? n : 0));
+  if (n < 0  &&  errno != EAGAIN  &&  errno != EINTR)
+    failed = eof = true;
+  else if (n == 0)
+    eof = true;
+
+  if (!checkedheader  ||  wavheader) {
+    if (!ParseWavHeader()) {
+      failed = eof = true;
+      pending.clear();
+      start = 0U;
+    }
+  }
+  return !eof;
+}
+
+bool PlaybackStream::ParseWavHeader()
+{
+  size_t len = pending.size() - start;
+  const BYTE *p = &pending[start];
+  if (!checkedheader) {
+    if (len < 4  &&  !eof)
+      return true;
+    checkedheader = true;
+    wavheader = len >= 4  &&  !memcmp(p, "RIFF", 4);
+    if (!wavheader)
+      return true;
+  }
+
+  // walk the chunks up to data, waiting for each one to arrive whole
+  bool pcm = false;
+  size_t pos = 12;
+  while (pos + 8 <= len) {
+    size_t chunklen = GetLE32(p + pos + 4);
+    if (!memcmp(p + pos, "data", 4)) {
+      if (!pcm)
+        break;
+      wavheader = false;
+      start += pos + 8;
+      return true;
+    }
+    if (pos + 8 + chunklen > len)
+      return !eof;
+    if (!memcmp(p + pos, "fmt ", 4)  &&  chunklen >= 16) {
+      if (GetLE16(p + pos + 8) != 1  ||  GetLE16(p + pos + 10) != 1
+          ||  GetLE32(p + pos + 12) != rate  ||  GetLE16(p + pos + 22) != 16) {
+        std::cerr << "PlaybackStream::" << __func__ << ": the stream must be"
+          << " 16 bit mono PCM at " << rate << " Hz" << std::endl;
+        return false;
+      }
+      pcm = true;
+    }
+    // chunks are padded to even length
+    pos += 8 + chunklen + (chunklen & 1);
+  }
+  if (pos + 8 <= len  ||  eof) {
+    std::cerr << "PlaybackStream::" << __func__
+      << ": no PCM format before the data" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void PlaybackStream::Consume(size_t len)
+{
+  start += len;
+}
+
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
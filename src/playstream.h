@@ -0,0 +1,88 @@
+/*
+ * sipcmd, playstream.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#ifndef PLAYSTREAM_H
+#define PLAYSTREAM_H
+
+#include <vector>
+#include "includes.h"
+
+// audio gathered before the first frame plays, against a bursty source
+#define PLAYBACK_STREAM_PREBUFFER_MS		200
+// unplayed bytes held beyond the ring before the source is left to wait
+#define PLAYBACK_STREAM_MAX_PENDING		(1U << 16)
+
+// A live playback source for v- (stdin) and vfifo:<path>, read as the
+// audio arrives. It carries 16 bit mono PCM at the call's rate, raw or as
+// a WAV whose header is skipped; a streamed WAV's sizes are ignored. Reads
+// wait at most the given time, so the caller keeps its pacing.
+class PlaybackStream
+{
+  public:
+    // whether a voice filename names a stream rather than a file
+    static bool IsStreamSource(const PString &name);
+
+    // opens stdin or the FIFO without waiting for a writer
+    // -returns NULL if it cannot be opened
+    static PlaybackStream *Open(const PString &name, unsigned rate);
+
+    ~PlaybackStream();
+
+    // waits up to 'millis' for audio and appends what arrived, keeping at
+    // most 'max' bytes pending
+    // -returns false at the end of the stream or on an error
+    bool Fill(unsigned millis, size_t max = PLAYBACK_STREAM_MAX_PENDING);
+
+    // audio ready to play, whole samples only
+    const BYTE *GetData() const { return pending.data() + start; }
+    size_t GetPending() const {
+      return wavheader ? 0U : (pending.size() - start) & ~(size_t)1;
+    }
+    void Consume(size_t len);
+
+    bool IsEOF() const { return eof; }
+    bool Failed() const { return failed; }
+
+    // the jitter pre-buffer of every stream, --stream-prebuffer
+    static void SetPrebufferMillis(unsigned ms) { prebufferms = ms; }
+    static unsigned GetPrebufferMillis() { return prebufferms; }
+
+  private:
+    PlaybackStream(int f, bool owned, unsigned rate);
+    // skips a WAV header at the start once all of it has arrived
+    // -returns false if it is not 16 bit mono PCM at the call's rate
+    bool ParseWavHeader();
+
+    int fd;
+    bool ownsfd;
+    unsigned rate;
+    std::vector< BYTE> pending;
+    size_t start;
+    bool checkedheader;
+    bool wavheader;             // still reading a WAV header
+    bool eof;
+    bool failed;
+
+    static unsigned prebufferms;
+};
+
+#endif // PLAYSTREAM_H
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
@@ -0,0 +1,167 @@
+/*
+ * sipcmd, recstream.cpp
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "recstream.h"
+
+static inline void PutLE16(BYTE *p, unsigned v) {
+  p[0] = v & 0xFF;
+  p[1] = (v >> 8) & 0xFF;
+}
+
+static inline void PutLE32(BYTE *p, unsigned v) {
+  PutLE16(p, v & 0xFFFF);
+  PutLE16(p + 2, v >> 16);
+}
+
+RecordStream::RecordStream(int f, bool owned, bool sock)
+  : PChannel(), fd(f), ownsfd(owned), socket(sock)
+{
+}
+
+RecordStream::~RecordStream()
+{
+  Close();
+}
+
+bool RecordStream::IsStreamTarget(const PString &target)
+{
+  if (target == "-"  ||  target.Left(5) == "unix:")
+    return true;
+  struct stat st;
+  std::string path = target;
+  return stat(path.c_str(), &st) == 0  &&  S_ISFIFO(st.st_mode);
+}
+
+void RecordStream::ClaimStdout()
+{
+  static bool claimed = false;
+  if (claimed)
+    return;
+  claimed = true;
+  std::cout.flush();
+  std::cout.rdbuf(std::cerr.rdbuf());
+}
+
+RecordStream *RecordStream::Create(const PString &target,
+    const AudioProperties &format, AudioProperties::Encoding encoding,
+    unsigned callid)
+{
+  // a consumer that goes away fails the write instead of killing us
+  signal(SIGPIPE, SIG_IGN);
+
+  RecordStream *stream = NULL;
+  std::string path = target;
+  if (target == "-")
+    stream = new RecordStream(STDOUT_FILENO, false, false);
+  else if (target.Left(5) == "unix:") {
+    path = path.substr(5);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    int s = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (path.size() >= sizeof(addr.sun_path)  ||  s < 0) {
+      std::cerr << "RecordStream::" << __func__ << ": bad socket \""
+        << path << "\"" << std::endl;
+      if (s >= 0)
+        close(s);
+      return NULL;
+    }
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(s, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+      std::cerr << "RecordStream::" << __func__ << ": cannot connect to \""
+        << path << "\": " << strerror(errno) << std::endl;
+      close(s);
+      return NULL;
+    }
+    stream = new RecordStream(s, true, true);
+  }
+  else {
+    // non-blocking only to fail at once when nobody reads the FIFO
+    int f = open(path.c_str(), O_WRONLY | O_NONBLOCK);
+    if (f < 0) {
+      std::cerr << "RecordStream::" << __func__ << ": cannot open FIFO \""
+        << path << "\": " << strerror(errno) << std::endl;
+      return NULL;
+    }
+    fcntl(f, F_SETFL, fcntl(f, F_GETFL) & ~O_NONBLOCK);
+    stream = new RecordStream(f, true, false);
+  }
+
+  BYTE header[RECORD_STREAM_HEADER_BYTES];
+  memcpy(header, RECORD_STREAM_MAGIC, 4);
+  header[4] = RECORD_STREAM_VERSION;
+  // 0 PCM16, 1 mu-law, 2 A-law as in AudioProperties::Encoding
+  header[5] = (BYTE)encoding;
+  PutLE16(header + 6, 1);
+  PutLE32(header + 8, format.GetSampleRate());
+  PutLE32(header + 12, callid);
+  if (!stream->Write(header, sizeof(header))) {
+    std::cerr << "RecordStream::" << __func__ << ": cannot write to \""
+      << target << "\"" << std::endl;
+    delete stream;
+    return NULL;
+  }
+  return stream;
+}
+
+void RecordStream::MakeFrameHeader(BYTE *header, unsigned offset,
+    unsigned len)
+{
+  PutLE32(header, offset);
+  PutLE32(header + 4, len);
+}
+
+bool RecordStream::Write(const void *buf, PINDEX len)
+{
+  lastWriteCount = 0;
+  const char *p = static_cast< const char *>(buf);
+  while (len > 0) {
+    ssize_t n = socket ? send(fd, p, len, MSG_NOSIGNAL) : write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    p += n;
+    len -= n;
+    lastWriteCount += n;
+  }
+  return true;
+}
+
+bool RecordStream::Close()
+{
+  if (fd < 0)
+    return true;
+  bool ok = !ownsfd  ||  close(fd) == 0;
+  fd = -1;
+  return ok;
+}
+
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
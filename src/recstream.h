@@ -0,0 +1,83 @@
+/*
+ * sipcmd, recstream.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#ifndef RECSTREAM_H
+#define RECSTREAM_H
+
+#include "includes.h"
+#include "audioprops.h"
+
+// queued frames beyond this are dropped, 2 s of 8 kHz PCM16
+#define RECORD_STREAM_RING_BYTES		(1U << 15)
+// a live consumer gets every frame within this
+#define RECORD_STREAM_FLUSH_INTERVAL_MS		20
+
+// stream header: "SCAU", version, encoding, channels, rate, call number
+#define RECORD_STREAM_MAGIC			"SCAU"
+#define RECORD_STREAM_VERSION			1
+#define RECORD_STREAM_HEADER_BYTES		16
+// frame header: sample offset of the frame, payload bytes
+#define RECORD_STREAM_FRAME_HEADER_BYTES	8
+
+// A live record target: "-" is stdout, "unix:<path>" a listening Unix
+// stream socket, and an existing FIFO is written to as it is. The stream
+// starts with a header giving the audio format, then every frame carries
+// its offset in samples from the start of the recording and its length,
+// all little endian. Offsets keep counting over dropped frames, so a
+// consumer sees where the gaps are. Writes block the record writer
+// thread only, never the media thread.
+class RecordStream : public PChannel
+{
+    PCLASSINFO(RecordStream, PChannel);
+
+  public:
+    // whether a record filename names a stream rather than a file
+    static bool IsStreamTarget(const PString &target);
+
+    // connects to the target and writes the stream header
+    // -returns NULL if it cannot be opened
+    static RecordStream *Create(const PString &target,
+        const AudioProperties &format, AudioProperties::Encoding encoding,
+        unsigned callid);
+
+    // sends stdout's text to stderr, so that stdout carries only audio;
+    // done when a program is compiled, before anything is printed
+    static void ClaimStdout();
+
+    static void MakeFrameHeader(BYTE *header, unsigned offset,
+        unsigned len);
+
+    ~RecordStream();
+
+    virtual bool Write(const void *buf, PINDEX len);
+    virtual bool Close();
+    virtual bool IsOpen() const { return fd >= 0; }
+
+  private:
+    RecordStream(int f, bool owned, bool sock);
+
+    int fd;
+    bool ownsfd;
+    bool socket;
+};
+
+#endif // RECSTREAM_H
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
@@ -0,0 +1,208 @@
+/*
+ * sipcmd, recwriter.cpp
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#include <cassert>
+#include "recwriter.h"
+
+RecordWriter::RecordWriter(PChannel *f, size_t capacity, unsigned flushms)
+  : PThread(10000, NoAutoDeleteThread, HighPriority, "RecordWriter"),
+  file(f), flushinterval(flushms), ring(capacity), mask(capacity - 1), head(0U), tail(0U),
+  stopping(false), failed(false), droppedframes(0UL), droppedbytes(0UL),
+  writtenbytes(0UL), wakeup(), finished(false)
+{
+  assert((capacity & mask) == 0);
+  Resume();
+}
+
+RecordWriter::~RecordWriter()
+{
+  Finish();
+}
+
+void RecordWriter::Put(size_t h, const void *buf, size_t len)
+{
+  const char *src = static_cast< const char *>(buf);
+  size_t pos = h & mask;
+  size_t first = ring.size() - pos < len ? ring.size() - pos : len;
+  memcpy(&ring[pos], src, first);
+  memcpy(&ring[0], src + first, len - first);
+}
+
+bool RecordWriter::Push(const void *buf, size_t len)
+{
+  return Push(NULL, 0U, buf, len);
+}
+
+bool RecordWriter::Push(const void *header, size_t headerlen,
+    const void *buf, size_t len)
+{
+  size_t h = head.load(std::memory_order_relaxed);
+  size_t used = h - tail.load(std::memory_order_acquire);
+  size_t total = headerlen + len;
+  if (total > ring.size() - used) {
+    droppedframes++;
+    droppedbytes += len;
+    return false;
+  }
+
+  if (headerlen)
+    Put(h, header, headerlen);
+  Put(h + headerlen, buf, len);
+  head.store(h + total, std::memory_order_release);
+
+  // wake the writer early once the ring is half full
+  if (used < ring.size() / 2  &&  used + total >= ring.size() / 2)
+    wakeup.Signal();
+  return true;
+}
+
+void RecordWriter::Flush()
+{
+  size_t t = tail.load(std::memory_order_relaxed);
+  size_t avail = head.load(std::memory_order_acquire) - t;
+  while (avail  &&  !failed) {
+    size_t pos = t & mask;
+    size_t chunk = ring.size() - pos < avail ? ring.size() - pos : avail;
+    if (!file->Write(&ring[pos], chunk)) {
+      std::cerr << "RecordWriter::" << __func__ << ": I/O error" << endl;
+      failed = true;
+      break;
+    }
+    writtenbytes += chunk;
+    t += chunk;
+    avail -= chunk;
+    tail.store(t, std::memory_order_release);
+  }
+}
+
+void RecordWriter::Main()
+{
+  while (!stopping) {
+    wakeup.Wait(flushinterval);
+    Flush();
+  }
+  Flush();
+}
+
+bool RecordWriter::Finish()
+{
+  if (finished)
+    return !failed;
+  finished = true;
+
+  stopping = true;
+  wakeup.Signal();
+  WaitForTermination();
+
+  file->Close();
+  delete file;
+  file = NULL;
+  return !failed;
+}
+
+
+////
+// G.711 WAV
+
+static inline void PutLE16(BYTE *p, unsigned v) {
+  p[0] = v & 0xFF;
+  p[1] = (v >> 8) & 0xFF;
+}
+
+static inline void PutLE32(BYTE *p, unsigned v) {
+  PutLE16(p, v & 0xFFFF);
+  PutLE16(p + 2, v >> 16);
+}
+
+G711WAVFile::G711WAVFile(G711::Law l, unsigned r)
+  : PFile(), law(l), rate(r)
+{
+}
+
+G711WAVFile::~G711WAVFile()
+{
+  // the base destructor would close without the sizes
+  Close();
+}
+
+void G711WAVFile::MakeHeader(BYTE *h, size_t datalen) const
+{
+  memcpy(h, "RIFF", 4);
+  PutLE32(h + 4, G711_WAV_HEADER_BYTES - 8 + datalen);
+  memcpy(h + 8, "WAVEfmt ", 8);
+  PutLE32(h + 16, 18);
+  PutLE16(h + 20, law == G711::ALAW ? 6 : 7);
+  PutLE16(h + 22, 1);               // mono
+  PutLE32(h + 24, rate);
+  PutLE32(h + 28, rate);            // a byte per sample
+  PutLE16(h + 32, 1);               // block align
+  PutLE16(h + 34, 8);               // bits per sample
+  PutLE16(h + 36, 0);               // no extra format bytes
+  // non-PCM formats carry their sample count in a fact chunk
+  memcpy(h + 38, "fact", 4);
+  PutLE32(h + 42, 4);
+  PutLE32(h + 46, datalen);
+  memcpy(h + 50, "data", 4);
+  PutLE32(h + 54, datalen);
+}
+
+bool G711WAVFile::OpenForRecording(const PFilePath &name, bool append)
+{
+  if (!Open(name, PFile::ReadWrite,
+        append ? PFile::Create : PFile::Create | PFile::Truncate))
+    return false;
+
+  BYTE header[G711_WAV_HEADER_BYTES];
+  if (GetLength() == 0) {
+    MakeHeader(header, 0U);
+    return Write(header, sizeof(header));
+  }
+
+  // only the sizes may differ from what we would write
+  BYTE ours[G711_WAV_HEADER_BYTES];
+  MakeHeader(ours, 0U);
+  if (!Read(header, sizeof(header))
+      ||  GetLastReadCount() != (PINDEX)sizeof(header)
+      ||  memcmp(header, ours, 4)  ||  memcmp(header + 8, ours + 8, 38)
+      ||  memcmp(header + 50, ours + 50, 4)) {
+    std::cerr << __func__ << ": " << name
+      << " is not a G.711 WAV of the call's format" << std::endl;
+    PFile::Close();
+    return false;
+  }
+  return SetPosition(0, PFile::End);
+}
+
+bool G711WAVFile::Close()
+{
+  if (!IsOpen())
+    return true;
+
+  long long len = GetLength();
+  size_t datalen = len > G711_WAV_HEADER_BYTES ?
+    (size_t)(len - G711_WAV_HEADER_BYTES) : 0U;
+  BYTE header[G711_WAV_HEADER_BYTES];
+  MakeHeader(header, datalen);
+  bool ok = SetPosition(0)  &&  Write(header, sizeof(header));
+  return PFile::Close()  &&  ok;
+}
+
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
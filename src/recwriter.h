@@ -0,0 +1,118 @@
+/*
+ * sipcmd, recwriter.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#ifndef RECWRITER_H
+#define RECWRITER_H
+
+#include <atomic>
+#include <vector>
+#include "includes.h"
+#include "g711.h"
+
+// ring size, power of two: 256 kB is 16 s of 8 kHz PCM16
+#define RECORD_RING_BYTES			(1U << 18)
+// the writer wakes up at least this often to flush the ring
+#define RECORD_FLUSH_INTERVAL_MS		200
+
+// Writes recorded audio to a file or stream on its own thread. The media
+// thread pushes into a single producer/single consumer ring and never
+// waits on the disk or the consumer; what does not fit is dropped and
+// counted.
+class RecordWriter : public PThread
+{
+    PCLASSINFO(RecordWriter, PThread);
+
+  public:
+    // takes ownership of the opened file or stream
+    RecordWriter(PChannel *f, size_t capacity = RECORD_RING_BYTES,
+        unsigned flushms = RECORD_FLUSH_INTERVAL_MS);
+    ~RecordWriter();
+
+    // media thread: queues a frame, dropping it whole if the ring is full
+    // -returns whether the frame was queued
+    bool Push(const void *buf, size_t len);
+    // the same for a frame behind a header, both or neither are queued
+    bool Push(const void *header, size_t headerlen,
+        const void *buf, size_t len);
+
+    // drains the ring, closes the file and ends the thread
+    // -returns false if any write failed
+    bool Finish();
+
+    bool Failed() const { return failed; }
+    unsigned long GetDroppedFrames() const { return droppedframes; }
+    unsigned long GetDroppedBytes() const { return droppedbytes; }
+    unsigned long GetWrittenBytes() const { return writtenbytes; }
+
+  private:
+    void Main();
+    // writes out whatever is in the ring, in at most two writes
+    void Flush();
+
+    // copies into the ring at the producer position
+    void Put(size_t pos, const void *buf, size_t len);
+
+    PChannel *file;
+    const unsigned flushinterval;
+    std::vector< char> ring;
+    const size_t mask;
+    std::atomic< size_t> head;      // producer position
+    std::atomic< size_t> tail;      // consumer position
+    std::atomic< bool> stopping;
+    std::atomic< bool> failed;
+    std::atomic< unsigned long> droppedframes;
+    std::atomic< unsigned long> droppedbytes;
+    unsigned long writtenbytes;
+    PSyncPoint wakeup;
+    bool finished;
+};
+
+// fixed header of a G.711 WAV: RIFF, an 18 byte fmt, fact and data
+#define G711_WAV_HEADER_BYTES			58
+
+// A WAV of G.711 code bytes as received, 8 bit mono with format tag 7
+// (mu-law) or 6 (A-law). PWAVFile only writes PCM, so the header is
+// written here on open and its sizes are patched on close.
+class G711WAVFile : public PFile
+{
+    PCLASSINFO(G711WAVFile, PFile);
+
+  public:
+    G711WAVFile(G711::Law law, unsigned rate);
+    ~G711WAVFile();
+
+    // creates the file, or appends to one of ours with the same law and
+    // rate when 'append' is set
+    // -returns false if it cannot be opened or its header differs
+    bool OpenForRecording(const PFilePath &name, bool append);
+
+    // patches the RIFF, fact and data sizes, then closes
+    virtual bool Close();
+
+  private:
+    void MakeHeader(BYTE *header, size_t datalen) const;
+
+    G711::Law law;
+    unsigned rate;
+};
+
+#endif // RECWRITER_H
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
@@ -0,0 +1,231 @@
+/*
+ * sipcmd, resample.cpp
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#include <cmath>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include "resample.h"
+#include "g711.h"
+
+bool PcmFormat::IsSupported() const
+{
+  if (!channels  ||  !rate)
+    return false;
+  if (encoding == FLOAT)
+    return bits == 32U  ||  bits == 64U;
+  if (encoding == ULAW  ||  encoding == ALAW)
+    return bits == 8U;
+  return bits == 8U  ||  bits == 16U  ||  bits == 24U  ||  bits == 32U;
+}
+
+static inline float Sample(const BYTE *p, const PcmFormat &fmt)
+{
+  if (fmt.encoding == PcmFormat::FLOAT) {
+    if (fmt.bits == 32U) {
+      float f;
+      memcpy(&f, p, sizeof(f));
+      return f;
+    }
+    double d;
+    memcpy(&d, p, sizeof(d));
+    return (float)d;
+  }
+  if (fmt.encoding != PcmFormat::INTEGER) {
+    short s;
+    G711::Decode(fmt.encoding == PcmFormat::ALAW ? G711::ALAW : G711::ULAW,
+        p, 1, &s);
+    return s / 32768.0f;
+  }
+
+  switch (fmt.bits) {
+    case 8U:
+      return ((int)p[0] - 128) / 128.0f;
+    case 16U:
+      return (short)(p[0] | (p[1] << 8)) / 32768.0f;
+    case 24U:
+      return ((int)((p[0] << 8) | (p[1] << 16) | ((unsigned)p[2] << 24))
+          >> 8) / 8388608.0f;
+    default:
+      return (int)(p[0] | (p[1] << 8) | (p[2] << 16)
+          | ((unsigned)p[3] << 24)) / 2147483648.0f;
+  }
+}
+
+static inline short Clip(float v)
+{
+  v *= 32768.0f;
+  return v >= 32767.0f ? 32767 : (v <= -32768.0f ? -32768 : (short)lrintf(v));
+}
+
+void ToPCM16(const std::vector< float> &in, std::vector< short> &out)
+{
+  out.reserve(out.size() + in.size());
+  for (size_t i = 0; i < in.size(); i++)
+    out.push_back(Clip(in[i]));
+}
+
+void DownmixToMono(const BYTE *data, size_t len, const PcmFormat &fmt,
+    std::vector< float> &mono)
+{
+  size_t width = fmt.bits / 8U;
+  size_t framebytes = fmt.GetFrameBytes();
+  size_t frames = len / framebytes;
+  mono.resize(frames);
+
+  const float scale = 1.0f / fmt.channels;
+  for (size_t i = 0; i < frames; i++) {
+    const BYTE *p = data + i * framebytes;
+    float sum = 0.0f;
+    for (unsigned c = 0; c < fmt.channels; c++)
+      sum += Sample(p + c * width, fmt);
+    mono[i] = sum * scale;
+  }
+}
+
+
+////
+// Resampler
+static unsigned gcd(unsigned a, unsigned b)
+{
+  while (b) {
+    unsigned t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+// zeroth order modified Bessel function of the first kind
+static double BesselI0(double x)
+{
+  double sum = 1.0, term = 1.0;
+  for (unsigned k = 1; k < 50; k++) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+    if (term < sum * 1e-12)
+      break;
+  }
+  return sum;
+}
+
+Resampler::Resampler(unsigned inrate, unsigned outrate)
+  : up(1U), down(1U), taps(4U), coefs()
+{
+  unsigned g = gcd(inrate, outrate);
+  up = outrate / g;
+  down = inrate / g;
+
+  // cutoff in cycles per input sample, zero crossings 1/(2fc) apart
+  double fc = 0.5 * RESAMPLE_ROLLOFF *
+    (outrate < inrate ? (double)outrate / inrate : 1.0);
+  double halfwidth = RESAMPLE_ZERO_CROSSINGS / (2.0 * fc);
+  taps = 2U * (unsigned)ceil(halfwidth);
+  taps = (taps + 3U) & ~3U;
+  coefs.assign((size_t)up * taps, 0.0f);
+
+  const double i0beta = BesselI0(RESAMPLE_KAISER_BETA);
+  for (unsigned p = 0; p < up; p++) {
+    // phase p sits p/up input samples after the tap at taps/2 - 1
+    double frac = (double)p / up;
+    float *h = &coefs[(size_t)p * taps];
+    double sum = 0.0;
+    for (unsigned k = 0; k < taps; k++) {
+      double d = (double)k - (taps / 2U - 1U) - frac;
+      double x = d / halfwidth;
+      if (x <= -1.0  ||  x >= 1.0)
+        continue;
+      double arg = 2.0 * fc * d;
+      double sinc = arg == 0.0 ? 1.0 : sin(M_PI * arg) / (M_PI * arg);
+      double w = BesselI0(RESAMPLE_KAISER_BETA * sqrt(1.0 - x * x)) / i0beta;
+      h[k] = (float)(2.0 * fc * sinc * w);
+      sum += h[k];
+    }
+    // unity gain at DC in every phase
+    for (unsigned k = 0; sum != 0.0  &&  k < taps; k++)
+      h[k] = (float)(h[k] / sum);
+  }
+}
+
+float Resampler::Dot(const float *a, const float *b, size_t n)
+{
+#if defined(__SSE2__)
+  __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+  size_t k = 0;
+  for (; k + 8 <= n; k += 8) {
+    acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + k),
+          _mm_loadu_ps(b + k)));
+    acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + k + 4),
+          _mm_loadu_ps(b + k + 4)));
+  }
+  for (; k < n; k += 4)
+    acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + k),
+          _mm_loadu_ps(b + k)));
+  float t[4];
+  _mm_storeu_ps(t, _mm_add_ps(acc0, acc1));
+  return (t[0] + t[1]) + (t[2] + t[3]);
+#elif defined(__ARM_NEON)
+  float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+  size_t k = 0;
+  for (; k + 8 <= n; k += 8) {
+    acc0 = vmlaq_f32(acc0, vld1q_f32(a + k), vld1q_f32(b + k));
+    acc1 = vmlaq_f32(acc1, vld1q_f32(a + k + 4), vld1q_f32(b + k + 4));
+  }
+  for (; k < n; k += 4)
+    acc0 = vmlaq_f32(acc0, vld1q_f32(a + k), vld1q_f32(b + k));
+  float32x4_t acc = vaddq_f32(acc0, acc1);
+  return (vgetq_lane_f32(acc, 0) + vgetq_lane_f32(acc, 1))
+    + (vgetq_lane_f32(acc, 2) + vgetq_lane_f32(acc, 3));
+#else
+  float sum = 0.0f;
+  for (size_t k = 0; k < n; k++)
+    sum += a[k] * b[k];
+  return sum;
+#endif
+}
+
+void Resampler::Process(const std::vector< float> &in,
+    std::vector< short> &out) const
+{
+  if (in.empty())
+    return;
+
+  // zeros around the input, so no output needs an edge case
+  std::vector< float> x(in.size() + 2U * taps, 0.0f);
+  memcpy(&x[taps], &in[0], in.size() * sizeof(float));
+
+  unsigned long long count =
+    ((unsigned long long)in.size() * up + down - 1U) / down;
+  out.reserve(out.size() + count);
+  for (unsigned long long j = 0; j < count; j++) {
+    unsigned long long pos = j * down;
+    size_t i0 = (size_t)(pos / up);
+    unsigned p = (unsigned)(pos % up);
+    // first tap at input i0 - (taps/2 - 1), shifted by the padding
+    const float *window = &x[i0 + taps - (taps / 2U - 1U)];
+    out.push_back(Clip(Dot(&coefs[(size_t)p * taps], window, taps)));
+  }
+}
+
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
@@ -0,0 +1,95 @@
+/*
+ * sipcmd, resample.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <stddef.h>
+#include <vector>
+#include "includes.h"
+
+// zero crossings of the interpolation filter on each side
+#define RESAMPLE_ZERO_CROSSINGS			16
+// passband edge as a fraction of the lower Nyquist frequency
+#define RESAMPLE_ROLLOFF			0.9
+// Kaiser window shape, about 80 dB stopband
+#define RESAMPLE_KAISER_BETA			8.0
+
+// sample format of a WAV data chunk
+struct PcmFormat {
+  enum Encoding {
+    INTEGER,
+    FLOAT,
+    ULAW,
+    ALAW
+  };
+
+  PcmFormat() : encoding(INTEGER), channels(0U), rate(0U), bits(0U) { }
+
+  // 8 bit unsigned, 16/24/32 bit signed, 32/64 bit float and 8 bit
+  // G.711, any rate and channel count
+  bool IsSupported() const;
+  bool IsSession(unsigned sessionrate) const {
+    return encoding == INTEGER  &&  channels == 1U  &&  bits == 16U
+      &&  rate == sessionrate;
+  }
+  size_t GetFrameBytes() const { return channels * (bits / 8U); }
+
+  Encoding encoding;
+  unsigned channels;
+  unsigned rate;
+  unsigned bits;
+};
+
+// decodes interleaved little endian samples and averages the channels
+// to mono, full scale 1.0; a partial last frame is ignored
+void DownmixToMono(const BYTE *data, size_t len, const PcmFormat &fmt,
+    std::vector< float> &mono);
+
+// rounds full scale samples to PCM16 with clipping, appending to 'out'
+void ToPCM16(const std::vector< float> &in, std::vector< short> &out);
+
+// Polyphase resampler for a fixed rational ratio. The prototype is a
+// Kaiser windowed sinc cut off below the lower of the two Nyquist
+// frequencies, split into one filter per output phase so every output
+// sample is a single dot product, which runs on SSE or NEON.
+class Resampler {
+  public:
+    Resampler(unsigned inrate, unsigned outrate);
+
+    // resamples the whole of 'in' to PCM16, appending to 'out'
+    void Process(const std::vector< float> &in,
+        std::vector< short> &out) const;
+
+    unsigned GetTaps() const { return taps; }
+    unsigned GetPhases() const { return up; }
+
+  private:
+    static float Dot(const float *a, const float *b, size_t n);
+
+    unsigned up;
+    unsigned down;
+    unsigned taps;              // per phase, a multiple of four
+    std::vector< float> coefs;  // 'up' phases of 'taps' coefficients
+};
+
+#endif // RESAMPLE_H
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
@@ -0,0 +1,135 @@
+/*
+ * sipcmd, rtpsender.cpp
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#include <ptclib/random.h>
+#include "rtpsender.h"
+#include "main.h"
+#include "state.h"
+#include "g711.h"
+
+static inline void AddMillis(struct timespec &ts, unsigned ms) {
+  ts.tv_nsec += (long)ms * 1000000L;
+  while (ts.tv_nsec >= 1000000000L) {
+    ts.tv_nsec -= 1000000000L;
+    ts.tv_sec++;
+  }
+}
+
+static inline long DiffMillis(const struct timespec &a,
+    const struct timespec &b) {
+  return (a.tv_sec - b.tv_sec) * 1000L
+    + (a.tv_nsec - b.tv_nsec) / 1000000L;
+}
+
+RTPSender::RTPSender(CallContext &ctx)
+  : context(ctx),
+  frame(ctx.GetPlayBackAudio().GetFormat().MillisToBytes(RTP_FRAME_MILLIS)),
+  timestamp(PRandom::Number()), haveslot(false), firstframe(true),
+  paced(true), framessent(0UL), latesends(0UL)
+{
+}
+
+void RTPSender::Begin()
+{
+  clock_gettime(CLOCK_MONOTONIC, &next);
+
+  // a new talkspurt: the timestamp covers the silence since the last one
+  if (haveslot) {
+    long gap = DiffMillis(next, lastslot);
+    if (gap > 0)
+      timestamp += gap *
+        context.GetPlayBackAudio().GetFormat().GetSampleRate() / 1000U;
+  }
+  firstframe = true;
+}
+
+bool RTPSender::SendFrame(const BYTE *data, size_t bytes)
+{
+  Manager *m = TPState::Instance().GetManager();
+  RTPSession *session = context.GetRTPSession();
+  if (!session)
+    return false;
+  const RTPSession::Payload payload = session->GetPayload();
+  frame.SetPayloadType(session->GetPayloadType());
+
+  size_t payloadbytes = bytes;
+  if (payload == RTPSession::PCM16) {
+    frame.SetPayloadSize(bytes);
+    memcpy(frame.GetPayloadPtr(), data, bytes);
+  } else {
+    // one code byte per sample, a trailing odd byte is dropped
+    payloadbytes = bytes / sizeof(short);
+    frame.SetPayloadSize(payloadbytes);
+    G711::Encode(payload == RTPSession::G711_ALAW ? G711::ALAW : G711::ULAW,
+        (const short *)data, payloadbytes, frame.GetPayloadPtr());
+  }
+  frame.SetTimestamp(timestamp);
+  frame.SetMarker(firstframe);
+
+  // wait for this frame's slot
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long behind = DiffMillis(now, next);
+  if (!paced)
+    next = now;
+  else if (behind < 0)
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+  else if (behind > RTP_LATE_THRESHOLD_MS) {
+    latesends++;
+    // do not burst out a backlog, restart the schedule from now
+    if (behind > RTP_RESYNC_THRESHOLD_MS)
+      next = now;
+  }
+
+  // the session fills in sequence number and SSRC
+  if (!m->WriteFrame(context, frame)) {
+    std::cerr << "RTP write failed" << std::endl;
+    return false;
+  }
+
+  timestamp += m->CalculateTimestamp(context, payloadbytes);
+  AddMillis(next, RTP_FRAME_MILLIS);
+  lastslot = next;
+  haveslot = true;
+  firstframe = false;
+  framessent++;
+  return true;
+}
+
+bool RTPSender::Send(const BYTE *data, size_t len,
+    const volatile bool &stop)
+{
+  const size_t framebytes =
+    context.GetPlayBackAudio().GetFormat().MillisToBytes(RTP_FRAME_MILLIS);
+
+  Begin();
+  size_t pos = 0U;
+  while (pos < len  &&  !stop
+      &&  context.GetState() != TPState::TERMINATED) {
+    size_t bytes = len - pos < framebytes ? len - pos : framebytes;
+    if (!SendFrame(data + pos, bytes))
+      return false;
+    pos += bytes;
+  }
+  return true;
+}
+
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
@@ -0,0 +1,77 @@
+/*
+ * sipcmd, rtpsender.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#ifndef RTPSENDER_H
+#define RTPSENDER_H
+
+#include <time.h>
+#include "includes.h"
+
+class CallContext;
+
+// media time carried by one frame in -P rtp mode
+#define RTP_FRAME_MILLIS			20
+// frames sent this much after their slot count as late
+#define RTP_LATE_THRESHOLD_MS			5
+// this far behind schedule the sender gives up catching up
+#define RTP_RESYNC_THRESHOLD_MS			200
+
+// Sends audio straight to the context's RTP session in -P rtp mode, paced
+// at the media rate from the monotonic clock. The frame is allocated once.
+// The RTP timestamp runs on across prompts, so consecutive Voice commands
+// are talkspurts of one stream.
+class RTPSender {
+  public:
+    RTPSender(CallContext &ctx);
+
+    // sends len bytes of PCM16 in frames of RTP_FRAME_MILLIS, G.711
+    // encoded when the session has a G.711 payload
+    // -stops early when 'stop' is set or the call terminates
+    // -returns false if a write failed
+    bool Send(const BYTE *data, size_t len, const volatile bool &stop);
+
+    // the same a frame at a time, for sources that arrive while playing:
+    // Begin starts a talkspurt, SendFrame waits for the next frame's slot
+    // and sends up to RTP_FRAME_MILLIS of audio
+    void Begin();
+    bool SendFrame(const BYTE *data, size_t len);
+
+    // unpaced senders write frames as fast as they can, for benchmarks
+    void SetPaced(bool p) { paced = p; }
+
+    unsigned long GetFramesSent() const { return framessent; }
+    unsigned long GetLateSends() const { return latesends; }
+
+  private:
+    CallContext &context;
+    RTP_DataFrame frame;
+    unsigned timestamp;
+    struct timespec next;           // slot of the next frame
+    struct timespec lastslot;
+    bool haveslot;
+    bool firstframe;
+    bool paced;
+    unsigned long framessent;
+    unsigned long latesends;
+};
+
+#endif // RTPSENDER_H
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
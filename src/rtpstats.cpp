@@ -0,0 +1,184 @@
+/*
+ * sipcmd, rtpstats.cpp
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#include <cmath>
+#include <cstdio>
+#include "rtpstats.h"
+
+// E-model for G.711 and linear PCM with packet loss concealment
+#define EMODEL_R0				93.2
+#define EMODEL_IE				0.0
+#define EMODEL_BPL				25.1
+// one-way delay is not known without RTCP round trips; take a 20 ms
+// frame, 20 ms of processing and a jitter buffer of twice the jitter
+#define EMODEL_BASE_DELAY_MS			40.0
+
+////
+// RtpReceiveStats
+void RtpReceiveStats::Reset()
+{
+  received = outoforder = duplicates = 0UL;
+  cycles = 0U;
+  baseseq = maxseq = 0U;
+  window = 0U;
+  transit = jitter = 0.0;
+  lastarrival = maxgap = 0;
+}
+
+void RtpReceiveStats::Update(uint16_t seq, uint32_t timestamp,
+    int64_t arrival, unsigned clockrate)
+{
+  if (!received) {
+    baseseq = maxseq = seq;
+    window = 1U;
+  }
+  else {
+    uint16_t ahead = (uint16_t)(seq - maxseq);
+    if (!ahead) {
+      duplicates++;
+      return;
+    }
+    if (ahead < 0x8000) {
+      // newer than anything seen, the sequence number may wrap
+      if (seq < maxseq)
+        cycles += 0x10000;
+      window = ahead < 64 ? (window << ahead) | 1U : 1U;
+      maxseq = seq;
+    }
+    else {
+      uint16_t behind = (uint16_t)(maxseq - seq);
+      if (behind < 64) {
+        if (window & (1ULL << behind)) {
+          duplicates++;
+          return;
+        }
+        window |= 1ULL << behind;
+      }
+      outoforder++;
+    }
+  }
+  received++;
+
+  // RFC 3550 A.8, in ms instead of timestamp units
+  double now = arrival / 1000.0;
+  double t = now - timestamp * 1000.0 / clockrate;
+  if (received > 1) {
+    double d = fabs(t - transit);
+    jitter += (d - jitter) / 16.0;
+    if (arrival - lastarrival > maxgap)
+      maxgap = arrival - lastarrival;
+  }
+  transit = t;
+  lastarrival = arrival;
+}
+
+////
+// RtpStats
+RtpStats::RtpStats() :
+  received(0UL), expected(0UL), lost(0L), outoforder(0UL),
+  duplicates(-1L), discards(0UL), jitter(0.0), maxjitter(0.0),
+  maxgap(0.0), sent(0UL), lostbyremote(0UL), jitteronremote(0.0)
+{
+}
+
+void RtpStats::FromSession(const RTP_Session &session)
+{
+  received = session.GetPacketsReceived();
+  lost = session.GetPacketsLost();
+  expected = received + lost;
+  outoforder = session.GetPacketsOutOfOrder();
+  discards = session.GetPacketsTooLate() + session.GetPacketOverruns();
+  jitter = session.GetAvgJitterTime();
+  maxjitter = session.GetMaxJitterTime();
+  maxgap = session.GetMaxTimeReceived();
+  sent = session.GetPacketsSent();
+  lostbyremote = session.GetPacketsLostByRemote();
+  jitteronremote = session.GetJitterTimeOnRemote();
+}
+
+void RtpStats::FromReceiver(const RtpReceiveStats &rx)
+{
+  received = rx.GetReceived();
+  expected = rx.GetExpected();
+  lost = (long)expected - (long)received;
+  outoforder = rx.GetOutOfOrder();
+  duplicates = rx.GetDuplicates();
+  jitter = rx.GetJitter();
+  if (jitter > maxjitter)
+    maxjitter = jitter;
+  maxgap = rx.GetMaxGap();
+}
+
+double RtpStats::RFactor(double losspct, double jitter)
+{
+  if (losspct < 0.0)
+    losspct = 0.0;
+  double ta = EMODEL_BASE_DELAY_MS + 2.0 * jitter;
+  double id = 0.024 * ta + (ta > 177.3 ? 0.11 * (ta - 177.3) : 0.0);
+  // random loss, BurstR = 1
+  double ieeff = EMODEL_IE
+    + (95.0 - EMODEL_IE) * losspct / (losspct + EMODEL_BPL);
+  double r = EMODEL_R0 - id - ieeff;
+  return r < 0.0 ? 0.0 : (r > 100.0 ? 100.0 : r);
+}
+
+double RtpStats::MOS(double r)
+{
+  if (r <= 0.0)
+    return 1.0;
+  if (r >= 100.0)
+    return 4.5;
+  return 1.0 + 0.035 * r + 7.0e-6 * r * (r - 60.0) * (100.0 - r);
+}
+
+void RtpStats::PrintJSON(ostream &os, unsigned callid,
+    unsigned sessionid) const
+{
+  // losses in the jitter buffer count like losses on the wire
+  double rxloss = expected ?
+    100.0 * ((lost > 0 ? lost : 0) + discards) / expected : 0.0;
+  double txloss = sent ? 100.0 * lostbyremote / sent : 0.0;
+  double rxr = RFactor(rxloss, jitter);
+  double txr = RFactor(txloss, jitteronremote);
+
+  char dup[24];
+  if (duplicates < 0)
+    snprintf(dup, sizeof(dup), "null");
+  else
+    snprintf(dup, sizeof(dup), "%ld", duplicates);
+
+  char buf[640];
+  snprintf(buf, sizeof(buf),
+      "{\"rtpstats\":{\"call\":%u,\"session\":%u,"
+      "\"rx\":{\"packets\":%lu,\"expected\":%lu,\"lost\":%ld,"
+      "\"outoforder\":%lu,\"duplicates\":%s,\"discards\":%lu,"
+      "\"jitter_ms\":%.2f,\"maxjitter_ms\":%.2f,\"maxgap_ms\":%.1f,"
+      "\"loss_pct\":%.2f,\"r\":%.1f,\"mos\":%.2f},"
+      "\"tx\":{\"packets\":%lu,\"lost\":%lu,\"jitter_ms\":%.2f,"
+      "\"loss_pct\":%.2f,\"r\":%.1f,\"mos\":%.2f}}}",
+      callid, sessionid,
+      received, expected, lost, outoforder, dup, discards,
+      jitter, maxjitter, maxgap, rxloss, rxr, MOS(rxr),
+      sent, lostbyremote, jitteronremote, txloss, txr, MOS(txr));
+  os << buf << std::endl;
+}
+
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
@@ -0,0 +1,98 @@
+/*
+ * sipcmd, rtpstats.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#ifndef RTPSTATS_H
+#define RTPSTATS_H
+
+#include <stdint.h>
+#include "includes.h"
+
+// Per-packet receive statistics of one RTP stream after RFC 3550
+// appendix A.1 and A.8, with duplicates found in a 64 packet window.
+// Fed from the receiving thread only.
+class RtpReceiveStats {
+  public:
+    RtpReceiveStats() { Reset(); }
+
+    // one received packet, arrival in us on the monotonic clock
+    void Update(uint16_t seq, uint32_t timestamp, int64_t arrival,
+        unsigned clockrate);
+    void Reset();
+
+    unsigned long GetReceived() const { return received; }
+    unsigned long GetExpected() const {
+      return received ? (unsigned long)(cycles + maxseq - baseseq + 1) : 0UL;
+    }
+    unsigned long GetOutOfOrder() const { return outoforder; }
+    unsigned long GetDuplicates() const { return duplicates; }
+    // interarrival jitter and largest gap between packets in ms
+    double GetJitter() const { return jitter; }
+    double GetMaxGap() const { return maxgap / 1000.0; }
+
+  private:
+    unsigned long received;
+    unsigned long outoforder;
+    unsigned long duplicates;
+    uint64_t cycles;
+    uint16_t baseseq;
+    uint16_t maxseq;
+    uint64_t window;            // bit n: maxseq - n was received
+    double transit;             // last relative transit time, ms
+    double jitter;
+    int64_t lastarrival;
+    int64_t maxgap;
+};
+
+// Statistics of both directions of one RTP session and an E-model
+// (ITU-T G.107) estimate of the listening quality.
+struct RtpStats {
+  RtpStats();
+
+  // takes what OPAL counted for the session
+  void FromSession(const RTP_Session &session);
+  // replaces the receive side by our own per-packet counts
+  void FromReceiver(const RtpReceiveStats &rx);
+
+  // one JSON object on one line
+  void PrintJSON(ostream &os, unsigned callid, unsigned sessionid) const;
+
+  // R-factor for a loss percentage and jitter in ms, and its MOS
+  static double RFactor(double losspct, double jitter);
+  static double MOS(double r);
+
+  // receive
+  unsigned long received;
+  unsigned long expected;
+  long lost;
+  unsigned long outoforder;
+  long duplicates;              // -1 if not counted
+  unsigned long discards;       // too late or overrun jitter buffer
+  double jitter;
+  double maxjitter;
+  double maxgap;
+  // send, as reported back by the remote in RTCP
+  unsigned long sent;
+  unsigned long lostbyremote;
+  double jitteronremote;
+};
+
+#endif // RTPSTATS_H
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
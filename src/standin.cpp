@@ -0,0 +1,263 @@
+/*
+ * sipcmd, standin.cpp
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#include <iostream>
+#include "standin.h"
+#include "commands.h"
+#include "state.h"
+
+////
+// StandInProfile
+StandInProfile::StandInProfile() :
+  answer(0U), echo(false), maxcalls(10U), calls(0UL)
+{
+}
+
+bool StandInProfile::Parse(const PString &spec)
+{
+  PStringArray items = spec.Tokenise(",");
+  for (PINDEX i = 0; i < items.GetSize(); i++) {
+    PString item = items[i].Trim();
+    if (item.IsEmpty())
+      continue;
+
+    PINDEX eq = item.Find('=');
+    if (eq == P_MAX_INDEX) {
+      std::cerr << "stand-in: missing value for \"" << item << "\""
+        << std::endl;
+      return false;
+    }
+
+    PString key = item.Left(eq).Trim().ToLower();
+    PString value = item.Mid(eq + 1).Trim();
+    if (key == "answer")
+      answer = value.AsUnsigned();
+    else if (key == "echo")
+      echo = value.AsUnsigned() != 0U;
+    else if (key == "max")
+      maxcalls = value.AsUnsigned();
+    else if (key == "calls")
+      calls = value.AsUnsigned();
+    else {
+      std::cerr << "stand-in: unknown key \"" << key << "\"" << std::endl;
+      return false;
+    }
+  }
+
+  if (maxcalls == 0U) {
+    std::cerr << "stand-in: need max > 0" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+
+////
+// StandInCall, serves one incoming call with the program
+class StandInCall : public PThread
+{
+    PCLASSINFO(StandInCall, PThread);
+
+  public:
+    StandInCall(StandIn &s, Manager &m, const Program &prog, unsigned n)
+      : PThread(10000, AutoDeleteThread, NormalPriority, "StandInCall"),
+      standin(s), manager(m), program(prog), slot(n) {
+        Resume();
+      }
+
+    void Main() {
+      bool ok, answered;
+      std::string error;
+      {
+        CallContext ctx(slot);
+        ctx.SetEcho(standin.GetProfile().echo);
+        manager.AttachContext(ctx);
+
+        ok = program.Run(ctx);
+        error = ctx.GetErrorString();
+        answered = !ctx.GetToken().IsEmpty();
+
+        // the caller normally hangs up, we need not
+        if (ctx.GetState() != TPState::CLOSED)
+          manager.Hangup(ctx);
+        manager.DetachContext(ctx);
+      }
+      standin.OnCallDone(slot, answered, ok, error);
+    }
+
+  private:
+    StandIn &standin;
+    Manager &manager;
+    const Program &program;
+    unsigned slot;
+};
+
+
+////
+// StandInAnswer, accepts a call once the answer delay is over
+class StandInAnswer : public PThread
+{
+    PCLASSINFO(StandInAnswer, PThread);
+
+  public:
+    StandInAnswer(Manager &m, const PString &t, unsigned millis)
+      : PThread(10000, AutoDeleteThread, NormalPriority, "StandInAnswer"),
+      manager(m), token(t), delay(millis) {
+        Resume();
+      }
+
+    void Main() {
+      PThread::Sleep(delay);
+
+      // the caller may have given up meanwhile
+      PSafePtr<OpalCall> call = manager.FindCallWithLock(token);
+      if (!call)
+        return;
+      PSafePtr<OpalConnection> connection = call->GetConnection(0);
+      if (connection)
+        connection->AnsweringCall(OpalConnection::AnswerCallNow);
+    }
+
+  private:
+    Manager &manager;
+    PString token;
+    unsigned delay;
+};
+
+
+////
+// StandIn
+StandIn::StandIn(Manager &m, const StandInProfile &p) :
+  manager(m), profile(p), mutex(), slots(p.maxcalls + 1, false),
+  active(0U), served(0UL), succeeded(0UL), failed(0UL), bindings()
+{
+  // slot 0 is left to the main context
+  slots[0] = true;
+}
+
+unsigned StandIn::AcquireSlot()
+{
+  PWaitAndSignal lock(mutex);
+  // no more listeners than there are calls still to come
+  if (profile.calls  &&  served + active >= profile.calls)
+    return 0U;
+  for (unsigned i = 1; i < slots.size(); i++) {
+    if (!slots[i]) {
+      slots[i] = true;
+      active++;
+      return i;
+    }
+  }
+  return 0U;
+}
+
+void StandIn::OnCallDone(unsigned slot, bool answered, bool ok,
+    const std::string &error)
+{
+  if (answered  &&  !ok)
+    std::cerr << "stand-in: call in slot " << slot << " failed: "
+      << error << std::endl;
+
+  PWaitAndSignal lock(mutex);
+  slots[slot] = false;
+  active--;
+  if (!answered)
+    return;
+  served++;
+  if (ok)
+    succeeded++;
+  else
+    failed++;
+}
+
+bool StandIn::Run(const Program &program)
+{
+  std::cerr << "stand-in: answer after " << profile.answer << " ms, echo "
+    << (profile.echo ? "on" : "off") << ", max " << profile.maxcalls
+    << " calls" << std::endl;
+
+  while (!TPState::Instance().IsTerminated()) {
+    {
+      PWaitAndSignal lock(mutex);
+      if (profile.calls  &&  served >= profile.calls)
+        break;
+    }
+
+    // keep a context listening in every free slot
+    unsigned slot = AcquireSlot();
+    if (slot) {
+      new StandInCall(*this, manager, program, slot);
+      continue;
+    }
+    PThread::Sleep(10);
+  }
+
+  // listeners still waiting in Answer give up on termination
+  std::cerr << "stand-in: waiting for " << active << " calls to finish"
+    << std::endl;
+  for (;;) {
+    {
+      PWaitAndSignal lock(mutex);
+      if (!active)
+        break;
+    }
+    PThread::Sleep(100);
+  }
+
+  PWaitAndSignal lock(mutex);
+  std::cout << "stand-in: served " << served << " calls"
+    << " ok " << succeeded
+    << " failed " << failed
+    << " registrations " << bindings.size() << std::endl;
+  return failed == 0UL;
+}
+
+bool StandIn::OnReceivedREGISTER(OpalTransport &transport, SIPEndPoint &ep,
+    SIP_PDU &pdu)
+{
+  SIPMIMEInfo &mime = pdu.GetMIME();
+  PString aor = mime.GetTo();
+  PString contact = mime.GetContact();
+  unsigned expires = mime.GetExpires(3600);
+
+  {
+    PWaitAndSignal lock(mutex);
+    if (expires)
+      bindings[(const char *)aor] = (const char *)contact;
+    else
+      bindings.erase((const char *)aor);
+  }
+  std::cerr << "stand-in: " << (expires ? "registered " : "unregistered ")
+    << aor << " at " << contact << " for " << expires << " s" << std::endl;
+
+  // no authentication, every binding is accepted as it came
+  SIP_PDU response(pdu, SIP_PDU::Successful_OK, contact);
+  response.GetMIME().SetExpires(expires);
+  pdu.SendResponse(transport, response, &ep);
+  return false;
+}
+
+void StandIn::AnswerLater(const PString &token)
+{
+  new StandInAnswer(manager, token, profile.answer);
+}
+
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
@@ -0,0 +1,100 @@
+/*
+ * sipcmd, standin.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#ifndef STANDIN_H
+#define STANDIN_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include "includes.h"
+
+class Program;
+class Manager;
+
+// program the stand-in serves calls with when -x is not given: answer
+// and hold the call until the caller hangs up
+#define STANDIN_DEFAULT_PROGRAM			"a;wc3600000"
+
+// stand-in profile, parsed from
+// --stand-in "answer=500,echo=1,max=10,calls=100"
+// answer is the delay in ms between the INVITE and the 200 OK, echo sends
+// the received audio back while nothing is played, max caps the calls in
+// progress and calls=N stops after N calls.
+class StandInProfile {
+  public:
+    StandInProfile();
+
+    bool Parse(const PString &spec);
+
+    unsigned answer;
+    bool echo;
+    unsigned maxcalls;
+    unsigned long calls;
+};
+
+// Plays the far end on the local host, for end to end runs without a
+// PBX. REGISTER is answered 200 OK by the SIP endpoint, and every INVITE
+// is served by the -x program on its own thread and call context, with
+// the same endpoints and media path sipcmd calls out with.
+class StandIn {
+  public:
+    StandIn(Manager &m, const StandInProfile &p);
+
+    const StandInProfile &GetProfile() const { return profile; }
+
+    // serves calls until the profile's call count is reached or the
+    // process is terminated, returns false if any call failed
+    bool Run(const Program &program);
+
+    // called from the call threads, 'answered' is false when the thread
+    // gave up before a call came in
+    void OnCallDone(unsigned slot, bool answered, bool ok,
+        const std::string &error);
+
+    // registrar: remembers the binding and answers 200 OK
+    // -returns false, the PDU is left to the caller
+    bool OnReceivedREGISTER(OpalTransport &transport, SIPEndPoint &ep,
+        SIP_PDU &pdu);
+
+    // sends the 200 OK for 'token' after the profile's answer delay
+    void AnswerLater(const PString &token);
+
+  private:
+    unsigned AcquireSlot();
+
+    Manager &manager;
+    StandInProfile profile;
+
+    PMutex mutex;
+    std::vector< bool> slots;
+    unsigned active;
+    unsigned long served;
+    unsigned long succeeded;
+    unsigned long failed;
+    std::map< std::string, std::string> bindings;
+
+    StandIn(const StandIn&);
+    StandIn operator=(StandIn&);
+};
+
+#endif // STANDIN_H
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
@@ -22,20 +22,23 @@
 #define STATE_H
 
 #include <string>
+#include <atomic>
+#include <pthread.h>
 #include "main.h"
 #include "channels.h"
+#include "latency.h"
 
-// audio properties
-#define BYTES_PER_MILLIS			16
-// sleep accuracy for 'Wait' command
-#define WAIT_SLEEP_ACCURACY			100
-// silence detection parameters
-#define MAX_SILENCE_DETECTION			(60000U * BYTES_PER_MILLIS)
-#define MAX_ACTIVITY_DETECTION			(60000U * BYTES_PER_MILLIS)
+// silence detection parameters, in ms of received audio; the byte sizes
+// are per stream, see audioprops.h
+#define MAX_SILENCE_DETECTION			60000U
+#define MAX_ACTIVITY_DETECTION			60000U
 #define WAIT_SILENCE_TIME_IN_MS			300U
 #define WAIT_ACTIVITY_TIME_IN_MS		100U
 #define RECORD_SILENCE_TIME_IN_MS		300U
 
+class RTPSession;
+class CallContext;
+
 class TPState {
   private:
     static TPState *instance;
@@ -61,41 +64,6 @@ class TPState {
       return *instance;
     }
 
-    void SetState( TPConnState newstate) {
-      stateSync.Wait();
-      if( state != TERMINATED)
-        state = newstate;
-      if( someonewaiting)
-        stateEventSync.Signal( PTimeInterval( 100 ) ); // 0.1 seconds to allow calls to timeout with more accuracy
-      stateSync.Signal();
-    }
-
-    TPConnState GetState( void) {
-      TPConnState st;
-      stateSync.Wait();
-      st = state;
-      stateSync.Signal();
-      return st;
-    }
-
-    TPConnState WaitForStateChange( TPConnState breakonstate = TERMINATED) {
-      // NOTE: not synchronized for multiple waiting threads
-      // Waiting for a state change
-      stateSync.Wait();
-      if( state == TERMINATED  ||  state == breakonstate) {
-        stateSync.Signal();
-        return state;
-      }
-      someonewaiting = true;
-      stateSync.Signal();
-
-      stateEventSync.Wait( PTimeInterval( 100 ) );
-      TPConnState newstate = state;
-      someonewaiting = false;
-      stateEventSync.Acknowledge();
-      return newstate;
-    }
-
     void SetProtocol( const TPProtocol p) { protocol = p; }
     void SetGateway( const PString &gw) { gateway = gw; }
     void SetLocalAddress( const PString &addr) { localaddress = addr; }
@@ -103,18 +71,12 @@ class TPState {
     void SetAliasName( const PString &alias) { aliasname = alias; }
     void SetGateKeeper( const PString &gk) { gatekeeper = gk; }
     void SetListenPort( const int portnum) { listenport = portnum; }
-    //void SetConnection( H323Connection *conn) { connection = conn; }
-    void SetToken( const PString &calltoken) { token = calltoken; }
     void SetManager(Manager *m) { manager = m; }
 
-    void SetSilenceState( bool is_silent, size_t buflen = 0U) {
-      if( state == STARTING  ||  state == CONNECTING) {
-        silence = 0; activity = 0; }
-      else if( !is_silent) { silence = 0;
-        if( activity < MAX_ACTIVITY_DETECTION) activity += buflen; }
-      else { activity = 0;
-        if( silence < MAX_SILENCE_DETECTION) silence += buflen; }
-    }
+    // process wide termination (signal), every call context sees it;
+    // set from the signal handler, hence lock free
+    void SetTerminated( void) { terminated = true; }
+    bool IsTerminated( void) const { return terminated; }
 
     const TPProtocol GetProtocol( void) { return protocol; }
     const PString &GetGateway( void) { return gateway; }
@@ -123,58 +85,153 @@ class TPState {
     const PString &GetAliasName( void) { return aliasname; }
     const PString &GetGateKeeper( void) { return gatekeeper; }
     const int GetListenPort( void) { return listenport; }
-    //H323Connection *GetConnection( void) { return connection; }
-    const PString &GetToken( void) { return token; }
     Manager *GetManager( void) { return manager; }
 
-    TestChanAudio &GetPlayBackAudio() { 
-      return playbackaudio; 
+  private:
+    std::atomic< bool> terminated;
+    PString gateway;
+    PString localaddress;
+    PString username;
+    PString aliasname;
+    PString gatekeeper;
+    int listenport;
+    Manager *manager;
+    TPProtocol protocol;
+
+    TPState()
+      : terminated( false), gateway(), localaddress(), username(),
+      aliasname(), gatekeeper(), listenport(5060), manager( NULL)
+  { }
+};
+
+// Everything that belongs to a single call: connection state, the call
+// token, silence detection and the playback/record channels. Commands,
+// media streams and Manager callbacks are keyed on this, so one process
+// can drive several calls at once sharing the endpoints.
+class CallContext {
+  public:
+    CallContext( unsigned callid = 0U);
+    ~CallContext();
+
+    // State machine. Any number of threads may wait. Every transition
+    // bumps the generation and every state or silence change bumps the
+    // event count, so a waiter that remembers what it has seen never
+    // misses a change.
+    void SetState( TPState::TPConnState newstate);
+    TPState::TPConnState GetState( void) const { return state; }
+    unsigned long GetGeneration( void) const { return generation; }
+
+    // waits until the state is 'breakonstate' or TERMINATED, or changes,
+    // for at most 'millis'; returns the state then
+    TPState::TPConnState WaitForStateChange(
+        TPState::TPConnState breakonstate = TPState::TERMINATED,
+        unsigned millis = 100U);
+
+    // monotonic time in ms the state was last entered, 0 if never
+    PInt64 GetTransitionTime( TPState::TPConnState st) const {
+      return transitions[StateIndex( st)];
     }
-    
-    TestChanAudio &GetRecordAudio() { 
-      return recordaudio; 
+
+    // event wait for the Wait command: take the event count, check the
+    // condition, then wait for the count to move on. SetSilenceState
+    // raises an event only when received audio turns silent or active or
+    // crosses a Wait threshold, so detection lags by at most one media
+    // frame without waking every waiter per frame.
+    unsigned long GetEventCount( void) const { return events; }
+    void WaitForEvent( unsigned long seen, unsigned millis);
+
+    // 'millis' of received audio were silent or not
+    void SetSilenceState( bool is_silent, unsigned millis = 0U) {
+      const unsigned was_silent = silence, was_active = activity;
+      TPState::TPConnState st = state;
+      if( st == TPState::STARTING  ||  st == TPState::CONNECTING) {
+        silence = 0; activity = 0; }
+      else if( !is_silent) { silence = 0;
+        if( activity < MAX_ACTIVITY_DETECTION) activity += millis; }
+      else { activity = 0;
+        if( silence < MAX_SILENCE_DETECTION) silence += millis; }
+      const unsigned now_silent = silence, now_active = activity;
+      if( (was_silent == 0) != (now_silent == 0)
+          ||  (was_active == 0) != (now_active == 0)
+          ||  (was_silent < WAIT_SILENCE_TIME_IN_MS)
+            != (now_silent < WAIT_SILENCE_TIME_IN_MS)
+          ||  (was_active < WAIT_ACTIVITY_TIME_IN_MS)
+            != (now_active < WAIT_ACTIVITY_TIME_IN_MS))
+        NotifyEvent();
     }
 
-    bool IsSilent( size_t buflen) {
-      if( buflen > MAX_SILENCE_DETECTION) buflen = MAX_SILENCE_DETECTION;
-      return silence >= buflen; 
+    bool IsSilent( unsigned millis) {
+      if( millis > MAX_SILENCE_DETECTION) millis = MAX_SILENCE_DETECTION;
+      return silence >= millis; 
     }
 
-    bool IsActive( size_t buflen) {
-      if( buflen > MAX_ACTIVITY_DETECTION) buflen = MAX_ACTIVITY_DETECTION;
-      return activity >= buflen; 
+    bool IsActive( unsigned millis) {
+      if( millis > MAX_ACTIVITY_DETECTION) millis = MAX_ACTIVITY_DETECTION;
+      return activity >= millis; 
     }
 
-  private:
+    unsigned GetId( void) const { return id; }
+    void SetToken( const PString &calltoken) { token = calltoken; }
+    const PString &GetToken( void) const { return token; }
 
-    PSyncPointAck stateEventSync;
-    PSemaphore stateSync;
-    TPConnState state;
-    volatile bool someonewaiting;
+    // incoming: call was answered by us (remote is connection 0)
+    void SetIncoming( bool in) { incoming = in; }
+    bool IsIncoming( void) const { return incoming; }
+    // listening: an Answer command waits for a call to bind to us
+    void SetListening( bool l) { listening = l; }
+    bool IsListening( void) const { return listening; }
+    // echo: received audio is sent back while nothing is played (stand-in)
+    void SetEcho( bool e) { echo = e; }
+    bool IsEcho( void) const { return echo; }
 
-    volatile size_t activity;
-    volatile size_t silence;
-    PString gateway;
-    PString localaddress;
-    PString username;
-    PString aliasname;
-    PString gatekeeper;
-    int listenport;
-    //H323Connection *connection;
+    void SetRTPSession( RTPSession *s) { rtpsession = s; }
+    RTPSession *GetRTPSession( void) { return rtpsession; }
+
+    // error of the last failed command run in this context
+    void SetErrorString( const std::string &e) { errorstring = e; }
+    const std::string &GetErrorString( void) const { return errorstring; }
+
+    // signalling and media milestones of the current call
+    CallTimeline &GetTimeline() { return timeline; }
+
+    TestChanAudio &GetPlayBackAudio() { 
+      return playbackaudio; 
+    }
+    
+    TestChanAudio &GetRecordAudio() { 
+      return recordaudio; 
+    }
+
+  private:
+    static unsigned StateIndex( TPState::TPConnState st) {
+      return st == TPState::TERMINATED ? 4U : (unsigned)st;
+    }
+    void NotifyEvent( void);
+
+    pthread_mutex_t stateMutex;
+    pthread_cond_t stateCond;
+    std::atomic< TPState::TPConnState> state;
+    std::atomic< unsigned long> generation;
+    std::atomic< unsigned long> events;
+    std::atomic< unsigned> waiters;
+    PInt64 transitions[5];
+
+    std::atomic< unsigned> activity;     // ms
+    std::atomic< unsigned> silence;      // ms
+    unsigned id;
     PString token;
-    Manager *manager;
+    bool incoming;
+    bool listening;
+    bool echo;
+    RTPSession *rtpsession;
+    std::string errorstring;
+    CallTimeline timeline;
 
     TestChanAudio playbackaudio;
     TestChanAudio recordaudio;
-    TPProtocol protocol;
 
-    TPState()
-      : stateEventSync(), stateSync( 1, 1), state( STARTING),
-      someonewaiting( false), activity( 0U), silence( 0U),
-      gateway(), localaddress(), username(),
-      aliasname(), gatekeeper(), listenport(5060), 
-      token(), manager( NULL), playbackaudio(), recordaudio()
-  { }
+    CallContext(const CallContext&);
+    CallContext operator=(CallContext&);
 };
 
 
@@ -0,0 +1,336 @@
+/*
+ * sipcmd, ttscache.cpp
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <ptclib/cypher.h>
+#include "ttscache.h"
+#include "audiocache.h"
+
+#define WAV_HEADER_BYTES			44
+// MD5 in hex and the extension
+#define TTS_ENTRY_NAME_CHARS			(32 + 4)
+
+TtsCache *TtsCache::instance = NULL;
+
+static inline void PutLE16(BYTE *p, unsigned v) {
+  p[0] = v & 0xFF;
+  p[1] = (v >> 8) & 0xFF;
+}
+
+static inline void PutLE32(BYTE *p, unsigned v) {
+  PutLE16(p, v & 0xFFFF);
+  PutLE16(p + 2, v >> 16);
+}
+
+// single quotes for sh, the text is whatever the program says
+static std::string ShellQuote(const std::string &s)
+{
+  std::string q = "'";
+  for (size_t i = 0; i < s.size(); i++) {
+    if (s[i] == '\'')
+      q += "'\\''";
+    else
+      q += s[i];
+  }
+  return q + "'";
+}
+
+
+////
+// TtsProfile
+TtsProfile::TtsProfile()
+  : voice(), dir(TTS_CACHE_DEFAULT_DIR), maxmbytes(TTS_CACHE_DEFAULT_MBYTES)
+{
+}
+
+bool TtsProfile::Parse(const PString &spec)
+{
+  PStringArray items = spec.Tokenise(",");
+  for (PINDEX i = 0; i < items.GetSize(); i++) {
+    PString item = items[i].Trim();
+    if (item.IsEmpty())
+      continue;
+
+    PINDEX eq = item.Find('=');
+    if (eq == P_MAX_INDEX) {
+      std::cerr << "tts: missing value for \"" << item << "\""
+        << std::endl;
+      return false;
+    }
+
+    PString key = item.Left(eq).Trim().ToLower();
+    PString value = item.Mid(eq + 1).Trim();
+    if (key == "voice")
+      voice = value;
+    else if (key == "dir")
+      dir = value;
+    else if (key == "max")
+      maxmbytes = value.AsUnsigned();
+    else {
+      std::cerr << "tts: unknown key \"" << key << "\"" << std::endl;
+      return false;
+    }
+  }
+
+  if (dir.IsEmpty()  ||  maxmbytes == 0U) {
+    std::cerr << "tts: need a dir and max > 0" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+
+////
+// TtsCache
+bool TtsCache::IsTextSource(const PString &name)
+{
+  return name.Left(4) == "tts:";
+}
+
+std::string TtsCache::Key(const PString &text, unsigned rate) const
+{
+  // everything the rendered file depends on
+  std::ostringstream key;
+  key << "pcm16 mono " << rate << '\n' << profile.voice << '\n' << text;
+  std::string k = key.str();
+
+  PMessageDigest5 md5;
+  md5.Process(k.data(), k.size());
+  PMessageDigest::Result digest;
+  md5.CompleteDigest(digest);
+
+  static const char hex[] = "0123456789abcdef";
+  std::string name;
+  for (PINDEX i = 0; i < digest.GetSize(); i++) {
+    name += hex[digest.GetPointer()[i] >> 4];
+    name += hex[digest.GetPointer()[i] & 0x0F];
+  }
+  return name;
+}
+
+PString TtsCache::Get(const PString &text, unsigned rate)
+{
+  std::string dir = profile.dir;
+  std::string path = dir + "/" + Key(text, rate) + ".wav";
+
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0) {
+    // eviction goes by last use, set explicitly as mounts may not
+    // keep access times; the mtime stays, it keys the prompt cache
+    struct timeval times[2];
+    gettimeofday(&times[0], NULL);
+    times[1].tv_sec = st.st_mtime;
+    times[1].tv_usec = 0;
+    utimes(path.c_str(), times);
+    PWaitAndSignal lock(mutex);
+    hits++;
+    return path;
+  }
+
+  {
+    PWaitAndSignal lock(mutex);
+    misses++;
+  }
+  if (command.IsEmpty()) {
+    std::cerr << "TtsCache::" << __func__ << ": \"" << text
+      << "\" is not cached and there is no --tts-cmd" << std::endl;
+    PWaitAndSignal lock(mutex);
+    failures++;
+    return PString();
+  }
+
+  mkdir(dir.c_str(), 0755);
+  if (!Render(text, rate, path)) {
+    PWaitAndSignal lock(mutex);
+    failures++;
+    return PString();
+  }
+  Evict(path);
+  return path;
+}
+
+bool TtsCache::Render(const PString &text, unsigned rate,
+    const std::string &path)
+{
+  // names of our own, another call may be rendering the same text
+  static std::atomic< unsigned> serial(0U);
+  std::ostringstream tmp;
+  tmp << path << '.' << getpid() << '.' << serial++;
+  std::string rendered = tmp.str() + ".render.wav";
+  std::string part = tmp.str() + ".part";
+
+  std::ostringstream rs;
+  rs << rate;
+  std::string cmd, tmpl = command;
+  for (size_t i = 0; i < tmpl.size(); i++) {
+    if (tmpl[i] != '%'  ||  i + 1 == tmpl.size()) {
+      cmd += tmpl[i];
+      continue;
+    }
+    switch (tmpl[++i]) {
+      case 't': cmd += ShellQuote(text); break;
+      case 'v': cmd += ShellQuote(profile.voice); break;
+      case 'o': cmd += ShellQuote(rendered); break;
+      case 'r': cmd += rs.str(); break;
+      default: cmd += tmpl[i]; break;
+    }
+  }
+
+  std::cerr << "TtsCache::" << __func__ << ": " << cmd << std::endl;
+  const PInt64 start = PTimer::Tick().GetMilliSeconds();
+  pid_t pid = fork();
+  if (pid == 0) {
+    // stdout may carry recorded audio, the command talks to stderr
+    int devnull = open("/dev/null", O_RDONLY);
+    if (devnull >= 0)
+      dup2(devnull, STDIN_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    execl("/bin/sh", "sh", "-c", cmd.c_str(), (char *)NULL);
+    _exit(127);
+  }
+  int status = -1;
+  if (pid > 0)
+    while (waitpid(pid, &status, 0) < 0  &&  errno == EINTR);
+  if (pid < 0  ||  !WIFEXITED(status)  ||  WEXITSTATUS(status) != 0) {
+    std::cerr << "TtsCache::" << __func__ << ": the command failed"
+      << std::endl;
+    unlink(rendered.c_str());
+    return false;
+  }
+
+  // whatever the engine wrote goes through the prompt converter once
+  AudioAssetPtr pcm = AudioCache::Load(rendered.c_str(), rate);
+  unlink(rendered.c_str());
+  if (!pcm  ||  !pcm->GetSize())
+    return false;
+
+  BYTE header[WAV_HEADER_BYTES];
+  memcpy(header, "RIFF", 4);
+  PutLE32(header + 4, WAV_HEADER_BYTES - 8 + pcm->GetSize());
+  memcpy(header + 8, "WAVEfmt ", 8);
+  PutLE32(header + 16, 16);
+  PutLE16(header + 20, 1);              // PCM
+  PutLE16(header + 22, 1);              // mono
+  PutLE32(header + 24, rate);
+  PutLE32(header + 28, rate * 2);
+  PutLE16(header + 32, 2);
+  PutLE16(header + 34, 16);
+  memcpy(header + 36, "data", 4);
+  PutLE32(header + 40, pcm->GetSize());
+
+  PFile file(part.c_str(), PFile::WriteOnly,
+      PFile::Create | PFile::Truncate);
+  bool ok = file.IsOpen()  &&  file.Write(header, sizeof(header))
+    &&  file.Write(pcm->GetPointer(), pcm->GetSize());
+  ok = file.Close()  &&  ok;
+  if (!ok  ||  rename(part.c_str(), path.c_str()) != 0) {
+    std::cerr << "TtsCache::" << __func__ << ": cannot write \"" << path
+      << "\"" << std::endl;
+    unlink(part.c_str());
+    return false;
+  }
+
+  std::cerr << "TtsCache::" << __func__ << ": rendered \"" << text
+    << "\" in " << PTimer::Tick().GetMilliSeconds() - start << " ms"
+    << std::endl;
+  PWaitAndSignal lock(mutex);
+  renders++;
+  return true;
+}
+
+void TtsCache::Evict(const std::string &keep)
+{
+  struct Prompt {
+    time_t used;
+    off_t size;
+    std::string path;
+    bool operator<(const Prompt &o) const { return used < o.used; }
+  };
+
+  std::string dir = profile.dir;
+  DIR *d = opendir(dir.c_str());
+  if (!d)
+    return;
+  std::vector< Prompt> prompts;
+  unsigned long long total = 0ULL;
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL) {
+    // only finished entries, temporary files belong to running renders
+    std::string name = e->d_name;
+    if (name.size() != TTS_ENTRY_NAME_CHARS
+        ||  name.compare(name.size() - 4, 4, ".wav"))
+      continue;
+    Prompt p;
+    p.path = dir + "/" + name;
+    struct stat st;
+    if (stat(p.path.c_str(), &st) != 0)
+      continue;
+    p.used = st.st_atime;
+    p.size = st.st_size;
+    total += p.size;
+    // counts towards the cap but stays, even if it alone exceeds it
+    if (p.path != keep)
+      prompts.push_back(p);
+  }
+  closedir(d);
+
+  // prompts still playing stay mapped after their file is gone
+  unsigned long long max = (unsigned long long)profile.maxmbytes << 20;
+  std::sort(prompts.begin(), prompts.end());
+  unsigned long removed = 0UL;
+  for (size_t i = 0; i < prompts.size()  &&  total > max; i++) {
+    if (unlink(prompts[i].path.c_str()) == 0) {
+      total -= prompts[i].size;
+      removed++;
+    }
+  }
+
+  PWaitAndSignal lock(mutex);
+  evictions += removed;
+}
+
+void TtsCache::PrintStats(ostream &os)
+{
+  PWaitAndSignal lock(mutex);
+  unsigned long lookups = hits + misses;
+  if (!lookups)
+    return;
+  os << "tts cache: hits " << hits
+    << " misses " << misses
+    << " renders " << renders
+    << " failures " << failures
+    << " evictions " << evictions
+    << " hit rate " << (100UL * hits + lookups / 2) / lookups << "%"
+    << std::endl;
+}
+
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
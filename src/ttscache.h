@@ -0,0 +1,104 @@
+/*
+ * sipcmd, ttscache.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#ifndef TTSCACHE_H
+#define TTSCACHE_H
+
+#include <string>
+#include "includes.h"
+
+// where rendered prompts are kept unless the profile says otherwise
+#define TTS_CACHE_DEFAULT_DIR			"/tmp/sipcmd-tts"
+// default disk cap of the rendered prompts
+#define TTS_CACHE_DEFAULT_MBYTES		64U
+
+// text to speech profile, parsed from
+// --tts "voice=de-DE,dir=/var/cache/sipcmd-tts,max=64"
+// voice is handed to the command as %v and is part of the cache key, dir
+// holds the rendered prompts and max caps their size on disk in MB.
+class TtsProfile {
+  public:
+    TtsProfile();
+
+    bool Parse(const PString &spec);
+
+    PString voice;
+    PString dir;
+    unsigned maxmbytes;
+};
+
+// Content addressed cache of text rendered by an external command
+// (--tts-cmd). A prompt is stored under the MD5 of its voice, format and
+// text, already converted to PCM16 at the session rate, so a hit is
+// played straight from a mapping of the file and the command only runs on
+// a miss. When the directory outgrows its cap the least recently played
+// prompts are removed. Entries are written under a temporary name and
+// renamed, so concurrent calls and processes can share the directory.
+class TtsCache {
+  public:
+    static TtsCache &Instance() {
+      if (!instance)
+        instance = new TtsCache();
+      return *instance;
+    }
+
+    // whether a voice filename is text to speak, "tts:<text>"
+    static bool IsTextSource(const PString &name);
+
+    void SetProfile(const TtsProfile &p) { profile = p; }
+    // the command renders %t (text) in %v (voice) to the WAV file %o;
+    // %r is the session rate, the output may have any rate and format
+    void SetCommand(const PString &cmd) { command = cmd; }
+
+    // returns the path of the prompt for 'text' at 'rate', rendering it
+    // on a miss
+    // -returns an empty string if it cannot be rendered
+    PString Get(const PString &text, unsigned rate);
+
+    void PrintStats(ostream &os);
+
+  private:
+    static TtsCache *instance;
+
+    std::string Key(const PString &text, unsigned rate) const;
+    // runs the command and converts its output to 'path'
+    bool Render(const PString &text, unsigned rate, const std::string &path);
+    // removes the least recently played prompts beyond the cap, never
+    // 'keep', the prompt about to be played
+    void Evict(const std::string &keep);
+
+    TtsProfile profile;
+    PString command;
+    PMutex mutex;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long failures;
+    unsigned long evictions;
+    unsigned long renders;
+
+    TtsCache()
+      : profile(), command(), mutex(), hits(0UL), misses(0UL),
+      failures(0UL), evictions(0UL), renders(0UL)
+  { }
+};
+
+#endif // TTSCACHE_H
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
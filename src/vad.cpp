@@ -0,0 +1,187 @@
+/*
+ * sipcmd, vad.cpp
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#include <cmath>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include "vad.h"
+
+// noise floor tracking per frame: falls fast, rises slowly, and during
+// speech slower still so that a step in background noise is learnt
+// within seconds instead of locking the detector in speech
+#define VAD_FLOOR_FALL				0.2
+#define VAD_FLOOR_RISE				0.01
+#define VAD_FLOOR_RISE_SPEECH			0.002
+#define VAD_SILENT_DBFS				-96.0
+
+VoiceActivityDetector::Params VoiceActivityDetector::defaults;
+
+VoiceActivityDetector::Params::Params() :
+  onset(9.0), release(6.0), minlevel(-55.0), maxzcr(0.45), hangover(200U)
+{
+}
+
+bool VoiceActivityDetector::Params::Parse(const PString &spec)
+{
+  PStringArray items = spec.Tokenise(",");
+  for (PINDEX i = 0; i < items.GetSize(); i++) {
+    PString item = items[i].Trim();
+    PINDEX eq = item.Find('=');
+    if (eq == P_MAX_INDEX) {
+      std::cerr << "vad: missing value for \"" << item << "\"" << std::endl;
+      return false;
+    }
+
+    PString key = item.Left(eq).Trim().ToLower();
+    PString value = item.Mid(eq + 1).Trim();
+    if (key == "onset")
+      onset = value.AsReal();
+    else if (key == "release")
+      release = value.AsReal();
+    else if (key == "minlevel")
+      minlevel = value.AsReal();
+    else if (key == "maxzcr")
+      maxzcr = value.AsReal();
+    else if (key == "hangover")
+      hangover = value.AsUnsigned();
+    else {
+      std::cerr << "vad: unknown key \"" << key << "\"" << std::endl;
+      return false;
+    }
+  }
+
+  if (release > onset) {
+    std::cerr << "vad: release must not exceed onset" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+VoiceActivityDetector::VoiceActivityDetector() : params(defaults)
+{
+  Reset();
+}
+
+void VoiceActivityDetector::Reset()
+{
+  noisefloor = params.minlevel;
+  speech = false;
+  quietmillis = 0U;
+  primed = false;
+}
+
+void VoiceActivityDetector::FrameStats(const short *x, size_t n,
+    uint64_t &energy, unsigned &crossings)
+{
+  energy = 0U;
+  crossings = 0U;
+  size_t i = 0U;
+
+#if defined(__SSE2__)
+  // pairwise squares with madd, at most 2^31 so exact as unsigned 32 bit
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc = zero;
+  unsigned signchanges = 0U;
+  for (; i + 9 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast< const __m128i *>(x + i));
+    __m128i next = _mm_loadu_si128(
+        reinterpret_cast< const __m128i *>(x + i + 1));
+    __m128i sq = _mm_madd_epi16(v, v);
+    acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+    __m128i diff = _mm_xor_si128(
+        _mm_srai_epi16(v, 15), _mm_srai_epi16(next, 15));
+    signchanges += __builtin_popcount(_mm_movemask_epi8(diff));
+  }
+  uint64_t lanes[2];
+  _mm_storeu_si128(reinterpret_cast< __m128i *>(lanes), acc);
+  energy = lanes[0] + lanes[1];
+  crossings = signchanges / 2;      // two mask bits per sample
+#elif defined(__ARM_NEON)
+  int64x2_t acc = vdupq_n_s64(0);
+  uint32x4_t cross = vdupq_n_u32(0);
+  for (; i + 9 <= n; i += 8) {
+    int16x8_t v = vld1q_s16(x + i);
+    int16x8_t next = vld1q_s16(x + i + 1);
+    acc = vpadalq_s32(acc, vmull_s16(vget_low_s16(v), vget_low_s16(v)));
+    acc = vpadalq_s32(acc, vmull_s16(vget_high_s16(v), vget_high_s16(v)));
+    uint16x8_t diff = vreinterpretq_u16_s16(
+        veorq_s16(vshrq_n_s16(v, 15), vshrq_n_s16(next, 15)));
+    cross = vpadalq_u16(cross, vshrq_n_u16(diff, 15));
+  }
+  energy = vgetq_lane_s64(acc, 0) + vgetq_lane_s64(acc, 1);
+  crossings = vgetq_lane_u32(cross, 0) + vgetq_lane_u32(cross, 1)
+    + vgetq_lane_u32(cross, 2) + vgetq_lane_u32(cross, 3);
+#endif
+
+  for (; i < n; i++) {
+    energy += (int)x[i] * x[i];
+    if (i + 1 < n  &&  ((x[i] ^ x[i + 1]) & 0x8000))
+      crossings++;
+  }
+}
+
+bool VoiceActivityDetector::IsSilent(const short *samples, size_t count,
+    unsigned millis)
+{
+  if (!count)
+    return !speech;
+
+  uint64_t energy;
+  unsigned crossings;
+  FrameStats(samples, count, energy, crossings);
+
+  double mean = (double)energy / count;
+  double level = mean > 0.0 ?
+    10.0 * log10(mean / (32768.0 * 32768.0)) : VAD_SILENT_DBFS;
+  double zcr = (double)crossings / count;
+
+  if (!primed) {
+    noisefloor = level > params.minlevel ? level : params.minlevel;
+    primed = true;
+  }
+
+  // loud frames that cross zero like white noise are not speech
+  bool noiselike = zcr > params.maxzcr  &&  level < noisefloor + params.onset * 2;
+  bool loud = level > params.minlevel  &&  !noiselike;
+  if (!speech) {
+    if (loud  &&  level > noisefloor + params.onset) {
+      speech = true;
+      quietmillis = 0U;
+    }
+  }
+  else if (loud  &&  level > noisefloor + params.release)
+    quietmillis = 0U;
+  else if ((quietmillis += millis) >= params.hangover)
+    speech = false;
+
+  double rate = level < noisefloor ? VAD_FLOOR_FALL :
+    (speech ? VAD_FLOOR_RISE_SPEECH : VAD_FLOOR_RISE);
+  noisefloor += (level - noisefloor) * rate;
+  if (noisefloor < params.minlevel)
+    noisefloor = params.minlevel;
+  return !speech;
+}
+
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2
@@ -0,0 +1,72 @@
+/*
+ * sipcmd, vad.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, 
+ * MA  02110-1301, USA.
+ *
+ */
+
+#ifndef VAD_H
+#define VAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "includes.h"
+
+// Energy and zero crossing voice activity detector for PCM16 frames.
+// The noise floor follows the background level, speech starts 'onset' dB
+// above it and ends 'release' dB above it after 'hangover' ms.
+class VoiceActivityDetector {
+  public:
+    // tunables, set with --vad "onset=9,release=6,..."
+    struct Params {
+      Params();
+      bool Parse(const PString &spec);
+
+      double onset;         // dB over noise floor to start speech
+      double release;       // dB over noise floor to stay in speech
+      double minlevel;      // dBFS, anything quieter is silence
+      double maxzcr;        // crossings per sample above which quiet
+                            // frames are taken for noise
+      unsigned hangover;    // ms of quiet before speech ends
+    };
+
+    VoiceActivityDetector();
+
+    static void SetDefaultParams(const Params &p) { defaults = p; }
+
+    // feeds one frame, returns whether the line is silent
+    bool IsSilent(const short *samples, size_t count, unsigned millis);
+
+    void Reset();
+    double GetNoiseFloor() const { return noisefloor; }
+
+    // frame energy (sum of squares) and number of sign changes
+    static void FrameStats(const short *samples, size_t count,
+        uint64_t &energy, unsigned &crossings);
+
+  private:
+    static Params defaults;
+
+    Params params;
+    double noisefloor;
+    bool speech;
+    unsigned quietmillis;
+    bool primed;
+};
+
+#endif // VAD_H
+//**// END OF FILE //**//
+// vim: tw=78 sw=2 sts=2